@@ -0,0 +1,95 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_ALIASTABLE_H_
+#define __VOTCA_KMC_ALIASTABLE_H_
+
+#include <vector>
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+/*
+ * Walker alias table (Vose's construction) for a static set of rates.
+ * Built once in O(n), afterwards an event is drawn with one random number and one table lookup.
+ */
+class Aliastable {
+public:
+    void Initialize(const vector<double> &rates);
+    int Draw(double u); // u uniform in [0,1)
+    int Size() { return table.size(); }
+
+private:
+    struct Column {
+        double prob; // probability to keep this column
+        int alias; // column taken otherwise
+    };
+    vector<Column> table;
+};
+
+void Aliastable::Initialize(const vector<double> &rates) {
+
+    int n = rates.size();
+    table.resize(n);
+    if (n == 0) { return; }
+
+    double total = 0.0;
+    for (int i = 0; i < n; i++) { total += rates[i]; }
+
+    // scaled probabilities, average 1
+    vector<double> scaled(n);
+    vector<int> small;
+    vector<int> large;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = (total > 0.0) ? rates[i]*n/total : 1.0;
+        if (scaled[i] < 1.0) { small.push_back(i); }
+        else { large.push_back(i); }
+    }
+
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(); small.pop_back();
+        int l = large.back(); large.pop_back();
+        table[s].prob = scaled[s];
+        table[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) { small.push_back(l); }
+        else { large.push_back(l); }
+    }
+
+    // leftovers are 1 up to round-off
+    for (unsigned int i = 0; i < large.size(); i++) {
+        table[large[i]].prob = 1.0;
+        table[large[i]].alias = large[i];
+    }
+    for (unsigned int i = 0; i < small.size(); i++) {
+        table[small[i]].prob = 1.0;
+        table[small[i]].alias = small[i];
+    }
+}
+
+inline int Aliastable::Draw(double u) {
+    // integer part picks the column, fractional part decides between column and alias
+    double x = u*table.size();
+    int i = (int) x;
+    if (i >= (int) table.size()) { i = table.size()-1; }
+    return (x - i < table[i].prob) ? i : table[i].alias;
+}
+
+}}
+
+#endif
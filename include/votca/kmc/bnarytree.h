@@ -0,0 +1,260 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_BNARYTREE_H_
+#define __VOTCA_KMC_BNARYTREE_H_
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#include <votca/kmc/ratetree.h>
+
+// B-ary partial sum tree, cache-blocked version of Bsumtree
+// Every internal node is one block of 8 double inclusive prefix sums (one cache line) over its 8 children,
+// so a search chooses the child on a level with one vector compare.
+// Leaves are stored in blocks of B and are scanned linearly at the bottom.
+// Levels are stored root first in one contiguous array, block b at level l has
+// its children at blocks b*8..b*8+7 at level l+1 (or leaf blocks on the bottom level).
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+template <typename Leaf, typename Index, int B>
+class Bnarytree : public Ratetree {
+public:
+    Bnarytree() : leaf_array(NULL), sum_array(NULL), nrelements(0), nrleafblocks(0), nrlevels(0) {}
+
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+
+private:
+    static const int cacheline = 64;
+    static const int Bsum = cacheline/sizeof(double); // Width of the internal blocks
+
+    int Count_smaller(const double* block, double key);
+    double Child_sum(int level, Index child);
+    void Recompute_block(int level, Index block);
+    template <typename T> T* Align_to_cacheline(vector<T>& storage, size_t size);
+
+    vector<Leaf> leaf_storage;
+    vector<double> sum_storage;
+    Leaf* leaf_array; // Leaves in blocks of B, padded with zeros (aligned)
+    double* sum_array; // Internal blocks of Bsum prefix sums, root level first (aligned)
+
+    vector<Index> level_offset; // First block of every level in sum_array
+    vector<Index> level_size; // Number of blocks on every level
+    vector<char> dirty_array; // Is the block dirty?
+    vector< vector<Index> > dirty_blocks; // Dirty blocks per level, so compute_sum only visits those
+
+    Index nrelements;
+    Index nrleafblocks;
+    int nrlevels;
+};
+
+// Double leaves with 8-wide blocks (one cache line per node)
+typedef Bnarytree<double, unsigned long, 8> Bnarytree8;
+// Float leaves and 32 bit indices, halves the leaf memory, 16 leaves per cache line (the prefix sums stay double)
+typedef Bnarytree<float, uint32_t, 16> Bnarytree16f;
+
+template <typename Leaf, typename Index, int B>
+void Bnarytree<Leaf,Index,B>::initialize(unsigned long nrelements) { // Must be called before use
+
+    this->nrelements = nrelements;
+    nrleafblocks = (nrelements + B - 1)/B;
+    if (nrleafblocks == 0) { nrleafblocks = 1; }
+
+    // number of blocks on every level, from the bottom to the root
+    vector<Index> sizes;
+    Index nrblocks = nrleafblocks;
+    do {
+        nrblocks = (nrblocks + Bsum - 1)/Bsum;
+        sizes.push_back(nrblocks);
+    } while (nrblocks > 1);
+    nrlevels = sizes.size();
+
+    level_offset.resize(nrlevels);
+    level_size.resize(nrlevels);
+    Index totalblocks = 0;
+    for (int level = 0; level < nrlevels; level++) {
+        level_size[level] = sizes[nrlevels-1-level];
+        level_offset[level] = totalblocks;
+        totalblocks += level_size[level];
+    }
+
+    leaf_array = Align_to_cacheline(leaf_storage, (size_t) nrleafblocks*B);
+    sum_array = Align_to_cacheline(sum_storage, (size_t) totalblocks*Bsum);
+    dirty_array.assign(totalblocks, false);
+    dirty_blocks.assign(nrlevels, vector<Index>());
+}
+
+template <typename Leaf, typename Index, int B>
+void Bnarytree<Leaf,Index,B>::setrate(unsigned long i, double value) { // 0 <= i < nrelements
+    leaf_array[i] = (Leaf) value;
+    Index block = (Index) (i/B)/Bsum;
+    int level = nrlevels-1;
+    while (level >= 0 && !dirty_array[level_offset[level] + block]) { // Mark this block and all parents dirty if not already
+        dirty_array[level_offset[level] + block] = true;
+        dirty_blocks[level].push_back(block);
+        block /= Bsum;
+        level--;
+    }
+}
+
+template <typename Leaf, typename Index, int B>
+double Bnarytree<Leaf,Index,B>::getrate(long i) {
+    return leaf_array[i];
+}
+
+template <typename Leaf, typename Index, int B>
+double Bnarytree<Leaf,Index,B>::compute_sum() { // Returns total sum of all elements
+    // Children are always on a lower level than their parents, so recompute bottom up
+    for (int level = nrlevels-1; level >= 0; level--) {
+        for (unsigned long idirty = 0; idirty < dirty_blocks[level].size(); idirty++) {
+            Recompute_block(level, dirty_blocks[level][idirty]);
+        }
+        dirty_blocks[level].clear();
+    }
+    return sum_array[Bsum-1];
+}
+
+// Search returns index to element i: sum(0..i) <= searchkey < sum(0..i+1),
+// where the sum is taken over the succesive elements (same convention as Bsumtree).
+template <typename Leaf, typename Index, int B>
+long Bnarytree<Leaf,Index,B>::search(double searchkey) { // Returns index to element
+
+    Index block = 0;
+    for (int level = 0; level < nrlevels; level++) {
+        const double* prefix = sum_array + (size_t) (level_offset[level] + block)*Bsum;
+        int child = Count_smaller(prefix, searchkey);
+        if (child == Bsum) { // rounding pushed the key past the block sum, take the last non-empty child
+            child = Count_smaller(prefix, prefix[Bsum-1]);
+            searchkey = prefix[child];
+        }
+        if (child > 0) { searchkey -= prefix[child-1]; } // values are relative
+        block = block*Bsum + child;
+    }
+
+    // Linear scan over one leaf block (one cache line)
+    const Leaf* leaves = leaf_array + (size_t) block*B;
+    double partsum = 0.0;
+    int last_nonzero = 0;
+    for (int ileaf = 0; ileaf < B; ileaf++) {
+        partsum += leaves[ileaf];
+        if (leaves[ileaf] > 0) { last_nonzero = ileaf; }
+        if (searchkey <= partsum) {
+            last_nonzero = ileaf;
+            break;
+        }
+    }
+    unsigned long i = (unsigned long) block*B + last_nonzero;
+    if (i >= nrelements && nrelements > 0) { i = nrelements - 1; }
+    return i;
+}
+
+template <typename Leaf, typename Index, int B>
+void Bnarytree<Leaf,Index,B>::resize(unsigned long newsize) { // Resize arrays. Expensive, so use with care!
+    /*
+     *  When newsize >= oldsize: all elements are copied, new elements are 0.
+     *  When newsize < oldsize: excess elements are thrown away.
+     */
+    vector<Leaf> temp_leaf_array(leaf_array, leaf_array + (nrelements < newsize ? nrelements : newsize));
+    initialize(newsize);
+    for (unsigned long i = 0; i < temp_leaf_array.size(); i++) {
+        leaf_array[i] = temp_leaf_array[i];
+    }
+    // All blocks have to be recomputed
+    for (int level = 0; level < nrlevels; level++) {
+        for (Index block = 0; block < level_size[level]; block++) {
+            dirty_array[level_offset[level] + block] = true;
+            dirty_blocks[level].push_back(block);
+        }
+    }
+}
+
+template <typename Leaf, typename Index, int B>
+long Bnarytree<Leaf,Index,B>::getnrrates() {
+    return nrelements;
+}
+
+template <typename Leaf, typename Index, int B>
+inline int Bnarytree<Leaf,Index,B>::Count_smaller(const double* block, double key) {
+    // Number of children whose inclusive prefix sum is below the key, i.e. the child the key falls in
+    int count = 0;
+#if defined(__AVX512F__)
+    __m512d vkey = _mm512_set1_pd(key);
+    count = __builtin_popcount(_mm512_cmp_pd_mask(_mm512_load_pd(block), vkey, _CMP_LT_OQ));
+#elif defined(__AVX__)
+    __m256d vkey = _mm256_set1_pd(key);
+    for (int ichild = 0; ichild < Bsum; ichild += 4) {
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_load_pd(block + ichild), vkey, _CMP_LT_OQ)));
+    }
+#else
+    for (int ichild = 0; ichild < Bsum; ichild++) { // branch free, vectorised by the compiler
+        count += (block[ichild] < key);
+    }
+#endif
+    return count;
+}
+
+template <typename Leaf, typename Index, int B>
+inline double Bnarytree<Leaf,Index,B>::Child_sum(int level, Index child) {
+    if (level == nrlevels - 1) { // children are leaf blocks
+        if (child >= nrleafblocks) { return 0.0; }
+        const Leaf* leaves = leaf_array + (size_t) child*B;
+        double sum = 0.0;
+        for (int ileaf = 0; ileaf < B; ileaf++) { sum += leaves[ileaf]; }
+        return sum;
+    }
+    else {
+        if (child >= level_size[level+1]) { return 0.0; } // Non-existent nodes have partial rate sum equal to 0
+        return sum_array[(size_t) (level_offset[level+1] + child)*Bsum + Bsum - 1];
+    }
+}
+
+template <typename Leaf, typename Index, int B>
+void Bnarytree<Leaf,Index,B>::Recompute_block(int level, Index block) {
+    double* prefix = sum_array + (size_t) (level_offset[level] + block)*Bsum;
+    double partsum = 0.0;
+    for (int ichild = 0; ichild < Bsum; ichild++) {
+        partsum += Child_sum(level, block*Bsum + ichild);
+        prefix[ichild] = partsum;
+    }
+    dirty_array[level_offset[level] + block] = false;
+}
+
+template <typename Leaf, typename Index, int B>
+template <typename T>
+T* Bnarytree<Leaf,Index,B>::Align_to_cacheline(vector<T>& storage, size_t size) {
+    // std::vector does not honour over-aligned types, so pad and align by hand
+    storage.assign(size + cacheline/sizeof(T), T(0));
+    uintptr_t address = reinterpret_cast<uintptr_t>(&storage[0]);
+    uintptr_t aligned = (address + cacheline - 1) & ~((uintptr_t) cacheline - 1);
+    return reinterpret_cast<T*>(aligned);
+}
+
+}}
+
+#endif
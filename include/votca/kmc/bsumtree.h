@@ -18,7 +18,11 @@
 #ifndef __VOTCA_KMC_BSUMTREE_H_
 #define __VOTCA_KMC_BSUMTREE_H_
 
-#include <valarray>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <votca/kmc/ratetree.h>
 //nrelements is number of leaves
 //treesize is number of nodes
 
@@ -26,42 +30,44 @@ namespace votca { namespace kmc {
   
 using namespace std;
 
-class Bsumtree {
+class Bsumtree : public Ratetree {
 public:
   void initialize(unsigned long nrelements);
   void setrate(unsigned long i, double value);
+  void setrates(const unsigned long* indices, const double* values, unsigned long n);
   double getrate(long i);
   double compute_sum();
   long search(double searchkey);
+  long search_relative(double &searchkey);
+  void search_many(const double* sorted_keys, long* out, unsigned long K);
   void resize(unsigned long newsize);
   long getnrrates();
   
 private:
   bool dirty(unsigned long i);
   double partsum(unsigned long i);
-  valarray<bool> dirty_array; // Are the subtrees dirty?
-  valarray<double> element_array; // The elements (summands)
-  valarray<double> partsum_array; // Array of partial sums
+  void grow_capacity();
+  vector<unsigned long> batch_nodes; // Scratch space for setrates
+  vector<double> search_keys; // Scratch space for search_many
+  vector<bool> dirty_array; // Are the subtrees dirty?
+  vector<double> element_array; // The elements (summands)
+  vector<double> partsum_array; // Array of partial sums
   unsigned long treesize;
   unsigned long nrelements;
 };
 
 void Bsumtree::initialize(unsigned long nrelements) { // Must be called before use
-  // treesize is the smallest power of two above nrelements minus 1
-  treesize = (unsigned long) pow(2,ceil(log((double) nrelements)/log((double) 2)))-1; // number of nodes
-    
-  dirty_array.resize(treesize);
-  if (element_array.size()<nrelements) { element_array.resize(nrelements); }
-  partsum_array.resize(treesize);
+  this->nrelements = nrelements;
+  // treesize is the smallest power of two above nrelements minus 1 (at least one node)
+  treesize = 1;
+  while (treesize+1 < nrelements) {
+    treesize = 2*treesize+1; // number of nodes
+  }
     
   // Initialize arrays
-  for (unsigned long i=0;i<treesize;i++) {
-    dirty_array[i] = false;
-    partsum_array[i] = 0.0;
-  }
-  for (unsigned long i=0;i<nrelements;i++) {
-    element_array[i] = 0.0;
-  }
+  dirty_array.assign(treesize, false);
+  partsum_array.assign(treesize, 0.0);
+  element_array.assign(nrelements, 0.0);
 }
 
 void Bsumtree::setrate(unsigned long i, double value) { // 0 <= i < nrelements
@@ -76,6 +82,42 @@ void Bsumtree::setrate(unsigned long i, double value) { // 0 <= i < nrelements
   }
 }
 
+void Bsumtree::setrates(const unsigned long* indices, const double* values, unsigned long n) {
+  /*
+   *  Bulk update: the touched leaves are sorted and deduplicated, then the partial sums
+   *  of their ancestors are recomputed level by level in one bottom-up pass, visiting
+   *  each ancestor once and in increasing (memory) order. The tree is clean afterwards.
+   */
+  if (n == 0) { return; }
+  if (dirty_array[0]) { compute_sum(); } // flush earlier single updates, children must be clean
+  
+  batch_nodes.resize(n);
+  for (unsigned long k=0;k<n;k++) { // later updates of the same leaf win
+    element_array[indices[k]] = values[k];
+    batch_nodes[k] = indices[k] + treesize;
+  }
+  sort(batch_nodes.begin(), batch_nodes.end());
+  batch_nodes.erase(unique(batch_nodes.begin(), batch_nodes.end()), batch_nodes.end());
+  
+  while (batch_nodes[0] != 0) {
+    // replace every node by its parent, parents of a sorted list are sorted
+    unsigned long nrparents = 0;
+    for (unsigned long k=0;k<batch_nodes.size();k++) {
+      unsigned long parent = (batch_nodes[k]-1)/2;
+      if (nrparents == 0 || batch_nodes[nrparents-1] != parent) {
+        batch_nodes[nrparents] = parent;
+        nrparents++;
+      }
+    }
+    batch_nodes.resize(nrparents);
+    for (unsigned long k=0;k<nrparents;k++) {
+      unsigned long parent = batch_nodes[k];
+      partsum_array[parent] = partsum(2*parent+1) + partsum(2*parent+2);
+      dirty_array[parent] = false;
+    }
+  }
+}
+
 double Bsumtree::getrate(long i) {
   return element_array[i];
 }
@@ -106,9 +148,13 @@ double Bsumtree::compute_sum() { // Returns total sum of all elements
 // Search returns index to element i: sum(0..i) <= searchkey < sum(0..i+1),
 // where the sum is taken over the succesive elements.
 long Bsumtree::search(double searchkey) { // Returns index to element
-  long maxindex = treesize + nrelements;
+  return search_relative(searchkey);
+}
+
+// Same as search, on return searchkey is relative to the start of the element (searchkey - sum(0..i))
+long Bsumtree::search_relative(double &searchkey) {
   long i = 0; // value must be located in subtree denoted by index i
-  while (2*i+2<maxindex) {
+  while (i<(long) treesize) { // descend until a leaf is reached
     if (searchkey <= partsum(2*i+1)) { // value is located in left subtree
       i = 2*i+1;
     }
@@ -118,22 +164,102 @@ long Bsumtree::search(double searchkey) { // Returns index to element
     }
   }
   i -= treesize;
+  if (i >= (long) nrelements) { i = nrelements-1; } // key rounded past the last element
   return i;
 }
 
-void Bsumtree::resize(unsigned long newsize) { // Resize arrays. Expensive, so use with care!
+// Draws K events from the same tree snapshot in one traversal. The keys must be sorted in
+// increasing order, out[k] is identical to search(sorted_keys[k]). At every node the key set
+// is split into the part that goes left and the part that goes right, so nodes shared by
+// several keys are loaded once.
+void Bsumtree::search_many(const double* sorted_keys, long* out, unsigned long K) {
+  if (K == 0) { return; }
+  search_keys.assign(sorted_keys, sorted_keys+K); // relative keys, updated in place like in search()
+  
+  struct Range { unsigned long node; unsigned long first; unsigned long last; };
+  vector<Range> stack;
+  Range root = {0, 0, K};
+  stack.push_back(root);
+  
+  while (!stack.empty()) {
+    Range range = stack.back();
+    stack.pop_back();
+    unsigned long i = range.node;
+    if (i >= treesize) { // leaf reached
+      long element = i - treesize;
+      if (element >= (long) nrelements) { element = nrelements-1; } // key rounded past the last element
+      for (unsigned long k=range.first;k<range.last;k++) {
+        out[k] = element;
+      }
+      continue;
+    }
+    double leftsum = partsum(2*i+1);
+    unsigned long split = range.first;
+    while (split < range.last && search_keys[split] <= leftsum) { // keys are sorted, so the left part is a prefix
+      split++;
+    }
+    for (unsigned long k=split;k<range.last;k++) { // values are relative
+      search_keys[k] -= leftsum;
+    }
+    if (split < range.last) {
+      Range right = {2*i+2, split, range.last};
+      stack.push_back(right);
+    }
+    if (range.first < split) {
+      Range left = {2*i+1, range.first, split};
+      stack.push_back(left);
+    }
+  }
+}
+
+void Bsumtree::resize(unsigned long newsize) { // Resize arrays without rebuilding the tree
   /*
-   *  When newsize >= oldsize: all elements are copied, new elements are 0.
-   *  When newsize < oldsize: excess elements are thrown away.
+   *  When newsize >= oldsize: all elements and partial sums are kept, new elements are 0.
+   *  The leaf level is doubled when it runs out of capacity, so growth is amortised.
+   *  When newsize < oldsize: excess elements are set to 0 (dirtying their spines) and thrown away.
    */
-  valarray<double> temp_element_array(double(0),newsize); // Temporary storage
-  for (unsigned long i=0;i<nrelements && i<newsize;i++) {
-    temp_element_array[i] = element_array[i];
+  if (newsize < nrelements) {
+    for (unsigned long i=newsize;i<nrelements;i++) {
+      setrate(i, 0.0);
+    }
+  }
+  else {
+    while (treesize+1 < newsize) {
+      grow_capacity();
+    }
   }
-  initialize(newsize);
-  for (unsigned long i=0;i<newsize;i++) {
-    setrate(i, temp_element_array[i]);
+  element_array.resize(newsize, 0.0); // new elements are 0, so no partial sum changes
+  nrelements = newsize;
+}
+
+void Bsumtree::grow_capacity() { // Double the leaf level, the old tree becomes the left subtree of a new root
+  /*
+   *  Node j on depth d of the old tree moves to j + 2^d on depth d+1. Levels are moved from
+   *  the bottom up, so no node is overwritten before it is moved. The right halves of the new
+   *  levels are empty subtrees (partial sum 0, clean).
+   */
+  unsigned long newtreesize = 2*treesize+1;
+  partsum_array.resize(newtreesize, 0.0);
+  dirty_array.resize(newtreesize, false);
+  
+  unsigned long levelsize = (treesize+1)/2; // number of nodes on the deepest level
+  while (levelsize > 0) {
+    unsigned long first = levelsize-1; // first node on this level
+    for (unsigned long k=levelsize;k>0;k--) {
+      partsum_array[first+k-1+levelsize] = partsum_array[first+k-1];
+      dirty_array[first+k-1+levelsize] = dirty_array[first+k-1];
+    }
+    for (unsigned long k=0;k<levelsize;k++) { // right half of the new level
+      partsum_array[first+2*levelsize+k] = 0.0;
+      dirty_array[first+2*levelsize+k] = false;
+    }
+    levelsize /= 2;
   }
+  
+  // The new root only has the old root as a non-empty child
+  partsum_array[0] = partsum_array[1];
+  dirty_array[0] = dirty_array[1];
+  treesize = newtreesize;
 }
 
 long Bsumtree::getnrrates() {
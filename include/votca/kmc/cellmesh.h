@@ -0,0 +1,284 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_CELLMESH_H_
+#define __VOTCA_KMC_CELLMESH_H_
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#include <votca/tools/vec.h>
+
+typedef votca::tools::vec myvec;
+
+// Flat cell list of the carriers in the box, used for the short range Coulomb interactions.
+// Cells are stored in CSR form (cell_start) with some slack per cell, the carriers in a cell
+// are contiguous in structure-of-arrays position arrays. A carrier is added by appending to its
+// cell and removed by moving the cell's last carrier into its slot; only a full cell triggers a
+// rebuild of the offsets.
+// Neighbours are gathered with a stencil of cell offsets precomputed once, culled to the cells
+// that can hold a point within the cutoff (sphere instead of cube), and a distance test that runs on
+// AVX when built with it (WITH_AVX).
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Cellmesh {
+public:
+    Cellmesh() : meshsizeX(0), meshsizeY(0), meshsizeZ(0), nrcells(0) {}
+
+    // cutoff is the largest distance Gather has to find, x is not periodic in a device
+    void Initialize(myvec sim_box_size, double cellsize, double cutoff, bool periodic_x);
+    void Add(int carrier_type, int carrier_ID, myvec position);
+    void Remove(int carrier_type, int carrier_ID);
+    long Cell_of(myvec position);
+
+    // All carriers within the cutoff of center, positions of periodic images shifted next to center
+    void Gather(myvec center);
+
+    int meshsizeX; int meshsizeY; int meshsizeZ;
+
+    // Result of Gather
+    vector<int> found_type;
+    vector<int> found_ID;
+    vector<double> found_x;
+    vector<double> found_y;
+    vector<double> found_z;
+
+private:
+    struct Stencil_offset {
+        int dx; int dy; int dz;
+    };
+
+    void Grow_cell(long cell);
+    void Test_cell(long cell, double cx, double cy, double cz, double shiftx, double shifty, double shiftz);
+
+    myvec sim_box_size;
+    double cellsizeX; double cellsizeY; double cellsizeZ; // cells tile the box exactly
+    double cutoff;
+    bool periodic_x;
+    long nrcells;
+    vector<Stencil_offset> stencil;
+
+    vector<long> cell_start; // First slot of every cell, nrcells+1 entries
+    vector<int> cell_count; // Carriers in every cell
+    vector<double> slot_x; // Positions, structure of arrays
+    vector<double> slot_y;
+    vector<double> slot_z;
+    vector<int> slot_type;
+    vector<int> slot_ID;
+    vector<long> slot_of[2]; // Slot of every carrier per carrier type, -1 if not in the mesh
+};
+
+void Cellmesh::Initialize(myvec sim_box_size, double cellsize, double cutoff, bool periodic_x) {
+
+    this->sim_box_size = sim_box_size;
+    this->cutoff = cutoff;
+    this->periodic_x = periodic_x;
+
+    meshsizeX = ceil(sim_box_size.x()/cellsize);
+    meshsizeY = ceil(sim_box_size.y()/cellsize);
+    meshsizeZ = ceil(sim_box_size.z()/cellsize);
+    nrcells = (long) meshsizeX*meshsizeY*meshsizeZ;
+    cellsizeX = sim_box_size.x()/meshsizeX;
+    cellsizeY = sim_box_size.y()/meshsizeY;
+    cellsizeZ = sim_box_size.z()/meshsizeZ;
+
+    // Keep the offsets whose cells can come closer than the cutoff
+    int rangeX = ceil(cutoff/cellsizeX);
+    int rangeY = ceil(cutoff/cellsizeY);
+    int rangeZ = ceil(cutoff/cellsizeZ);
+    stencil.clear();
+    for (int dx = -rangeX; dx <= rangeX; dx++) {
+        for (int dy = -rangeY; dy <= rangeY; dy++) {
+            for (int dz = -rangeZ; dz <= rangeZ; dz++) {
+                double gapx = max(std::abs(dx)-1, 0)*cellsizeX;
+                double gapy = max(std::abs(dy)-1, 0)*cellsizeY;
+                double gapz = max(std::abs(dz)-1, 0)*cellsizeZ;
+                if (gapx*gapx + gapy*gapy + gapz*gapz <= cutoff*cutoff) {
+                    Stencil_offset offset = {dx, dy, dz};
+                    stencil.push_back(offset);
+                }
+            }
+        }
+    }
+
+    int initial_capacity = 4;
+    cell_start.resize(nrcells+1);
+    for (long cell = 0; cell <= nrcells; cell++) { cell_start[cell] = cell*initial_capacity; }
+    cell_count.assign(nrcells, 0);
+    slot_x.assign(nrcells*initial_capacity, 0.0);
+    slot_y.assign(nrcells*initial_capacity, 0.0);
+    slot_z.assign(nrcells*initial_capacity, 0.0);
+    slot_type.assign(nrcells*initial_capacity, 0);
+    slot_ID.assign(nrcells*initial_capacity, 0);
+    slot_of[0].clear();
+    slot_of[1].clear();
+}
+
+long Cellmesh::Cell_of(myvec position) {
+    int ix = floor(position.x()/cellsizeX); if (ix >= meshsizeX) ix = meshsizeX-1; if (ix < 0) ix = 0;
+    int iy = floor(position.y()/cellsizeY); if (iy >= meshsizeY) iy = meshsizeY-1; if (iy < 0) iy = 0;
+    int iz = floor(position.z()/cellsizeZ); if (iz >= meshsizeZ) iz = meshsizeZ-1; if (iz < 0) iz = 0;
+    return ((long) ix*meshsizeY + iy)*meshsizeZ + iz;
+}
+
+void Cellmesh::Add(int carrier_type, int carrier_ID, myvec position) {
+    long cell = Cell_of(position);
+    if (cell_start[cell] + cell_count[cell] == cell_start[cell+1]) { Grow_cell(cell); }
+    long slot = cell_start[cell] + cell_count[cell];
+    cell_count[cell]++;
+    slot_x[slot] = position.x();
+    slot_y[slot] = position.y();
+    slot_z[slot] = position.z();
+    slot_type[slot] = carrier_type;
+    slot_ID[slot] = carrier_ID;
+    if ((long) slot_of[carrier_type].size() <= carrier_ID) { slot_of[carrier_type].resize(carrier_ID+1, -1); }
+    slot_of[carrier_type][carrier_ID] = slot;
+}
+
+void Cellmesh::Remove(int carrier_type, int carrier_ID) {
+    long slot = slot_of[carrier_type][carrier_ID];
+    long cell = upper_bound(cell_start.begin(), cell_start.end(), slot) - cell_start.begin() - 1;
+    long last = cell_start[cell] + cell_count[cell] - 1;
+    slot_x[slot] = slot_x[last];
+    slot_y[slot] = slot_y[last];
+    slot_z[slot] = slot_z[last];
+    slot_type[slot] = slot_type[last];
+    slot_ID[slot] = slot_ID[last];
+    slot_of[slot_type[slot]][slot_ID[slot]] = slot;
+    slot_of[carrier_type][carrier_ID] = -1;
+    cell_count[cell]--;
+}
+
+void Cellmesh::Gather(myvec center) {
+
+    found_type.clear(); found_ID.clear();
+    found_x.clear(); found_y.clear(); found_z.clear();
+
+    long center_cell = Cell_of(center);
+    int cz = center_cell % meshsizeZ;
+    int cy = (center_cell/meshsizeZ) % meshsizeY;
+    int cx = center_cell/((long) meshsizeY*meshsizeZ);
+
+    for (unsigned int istencil = 0; istencil < stencil.size(); istencil++) {
+        int ix = cx + stencil[istencil].dx;
+        int iy = cy + stencil[istencil].dy;
+        int iz = cz + stencil[istencil].dz;
+
+        // wrap into the box, remember the image shift (floor division)
+        int wrapx = (ix >= 0) ? ix/meshsizeX : -((-ix-1)/meshsizeX) - 1;
+        if (wrapx != 0 && !periodic_x) { continue; } // electrodes break periodicity in x
+        int wrapy = (iy >= 0) ? iy/meshsizeY : -((-iy-1)/meshsizeY) - 1;
+        int wrapz = (iz >= 0) ? iz/meshsizeZ : -((-iz-1)/meshsizeZ) - 1;
+        ix -= wrapx*meshsizeX;
+        iy -= wrapy*meshsizeY;
+        iz -= wrapz*meshsizeZ;
+
+        long cell = ((long) ix*meshsizeY + iy)*meshsizeZ + iz;
+        if (cell_count[cell] == 0) { continue; }
+        Test_cell(cell, center.x(), center.y(), center.z(),
+                  wrapx*sim_box_size.x(), wrapy*sim_box_size.y(), wrapz*sim_box_size.z());
+    }
+}
+
+inline void Cellmesh::Test_cell(long cell, double cx, double cy, double cz, double shiftx, double shifty, double shiftz) {
+
+    long first = cell_start[cell];
+    int count = cell_count[cell];
+    double cutsqr = cutoff*cutoff;
+    // Shift the center instead of every carrier
+    double px = cx - shiftx;
+    double py = cy - shifty;
+    double pz = cz - shiftz;
+    const double* x = &slot_x[first];
+    const double* y = &slot_y[first];
+    const double* z = &slot_z[first];
+
+    int k = 0;
+#if defined(__AVX__)
+    __m256d vpx = _mm256_set1_pd(px);
+    __m256d vpy = _mm256_set1_pd(py);
+    __m256d vpz = _mm256_set1_pd(pz);
+    __m256d vcut = _mm256_set1_pd(cutsqr);
+    for (; k+4 <= count; k += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x+k), vpx);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y+k), vpy);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z+k), vpz);
+        __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(d2, vcut, _CMP_LE_OQ));
+        while (mask != 0) { // visit the hits only
+            int lane = __builtin_ctz(mask);
+            mask &= mask-1;
+            long slot = first + k + lane;
+            found_type.push_back(slot_type[slot]);
+            found_ID.push_back(slot_ID[slot]);
+            found_x.push_back(slot_x[slot] + shiftx);
+            found_y.push_back(slot_y[slot] + shifty);
+            found_z.push_back(slot_z[slot] + shiftz);
+        }
+    }
+#endif
+    for (; k < count; k++) {
+        double dx = x[k] - px;
+        double dy = y[k] - py;
+        double dz = z[k] - pz;
+        if (dx*dx + dy*dy + dz*dz <= cutsqr) {
+            long slot = first + k;
+            found_type.push_back(slot_type[slot]);
+            found_ID.push_back(slot_ID[slot]);
+            found_x.push_back(slot_x[slot] + shiftx);
+            found_y.push_back(slot_y[slot] + shifty);
+            found_z.push_back(slot_z[slot] + shiftz);
+        }
+    }
+}
+
+void Cellmesh::Grow_cell(long cell) {
+    // Rebuild the offsets with twice the capacity for this cell, all other cells keep theirs
+    long extra = max(cell_start[cell+1] - cell_start[cell], 4L);
+    long oldsize = slot_x.size();
+    long newsize = oldsize + extra;
+    long tail = cell_start[cell+1]; // slots from here on move up by extra
+
+    slot_x.resize(newsize); slot_y.resize(newsize); slot_z.resize(newsize);
+    slot_type.resize(newsize); slot_ID.resize(newsize);
+    for (long slot = oldsize-1; slot >= tail; slot--) {
+        slot_x[slot+extra] = slot_x[slot];
+        slot_y[slot+extra] = slot_y[slot];
+        slot_z[slot+extra] = slot_z[slot];
+        slot_type[slot+extra] = slot_type[slot];
+        slot_ID[slot+extra] = slot_ID[slot];
+    }
+    for (long icell = cell+1; icell <= nrcells; icell++) {
+        cell_start[icell] += extra;
+    }
+    for (long icell = cell+1; icell < nrcells; icell++) { // moved carriers
+        for (long slot = cell_start[icell]; slot < cell_start[icell] + cell_count[icell]; slot++) {
+            slot_of[slot_type[slot]][slot_ID[slot]] = slot;
+        }
+    }
+}
+
+}}
+
+#endif
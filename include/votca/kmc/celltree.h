@@ -0,0 +1,206 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_CELLTREE_H_
+#define __VOTCA_KMC_CELLTREE_H_
+
+#include <vector>
+#include <votca/kmc/ratetree.h>
+#include <votca/kmc/bsumtree.h>
+#include <votca/kmc/twoleveltree.h>
+
+// Spatially partitioned rate tree: one subtree per coulomb mesh cell, a small Bsumtree over the cell sums on top.
+// Events are still addressed as block*block_size + slot (carrier_ID*max_pair_degree + jump), every block
+// (carrier) lives in the subtree of the cell it was last placed in with set_cell. A hop only changes rates
+// within coulcut+hopdist of the moving carrier, so a step dirties a few cell subtrees and a few spines
+// of the top tree, instead of spines scattered over one global tree.
+// Blocks that were never placed live in cell 0.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Celltree : public Ratetree {
+public:
+    Celltree() : block_size(1), nrelements(0) {}
+
+    void Set_block_size(unsigned long block_size) { this->block_size = block_size; } // Before initialize
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+    void set_cell(unsigned long block, unsigned long cell);
+
+private:
+    struct Cell {
+        Twoleveltree rates; // Jump rates of all blocks in this cell, one block per slot
+        vector<unsigned long> blocks; // Block in every slot
+        bool dirty;
+    };
+
+    void Add_cells(unsigned long nrcells);
+    void Add_to_cell(unsigned long block, unsigned long cell);
+    void Remove_from_cell(unsigned long block);
+
+    Bsumtree cell_tree; // Sum of every cell
+    vector<Cell> cells;
+    vector<unsigned long> dirty_cells;
+    vector<double> dirty_sums; // Scratch space for the bulk update of the cell tree
+    vector<unsigned long> block_cell; // Cell of every block
+    vector<unsigned long> block_slot; // Slot of every block within its cell
+    unsigned long block_size;
+    unsigned long nrelements;
+};
+
+void Celltree::initialize(unsigned long nrelements) { // Must be called before use
+    this->nrelements = nrelements;
+    cells.clear();
+    dirty_cells.clear();
+    block_cell.clear();
+    block_slot.clear();
+    cell_tree.initialize(0);
+    Add_cells(1);
+    unsigned long nrblocks = (nrelements + block_size - 1)/block_size;
+    for (unsigned long block = 0; block < nrblocks; block++) {
+        block_cell.push_back(0);
+        block_slot.push_back(0);
+        Add_to_cell(block, 0);
+    }
+}
+
+void Celltree::setrate(unsigned long i, double value) { // 0 <= i < nrelements
+    unsigned long block = i/block_size;
+    Cell &cell = cells[block_cell[block]];
+    cell.rates.setrate(block_slot[block]*block_size + i - block*block_size, value);
+    if (!cell.dirty) {
+        cell.dirty = true;
+        dirty_cells.push_back(block_cell[block]);
+    }
+}
+
+double Celltree::getrate(long i) {
+    unsigned long block = i/block_size;
+    return cells[block_cell[block]].rates.getrate(block_slot[block]*block_size + i - block*block_size);
+}
+
+double Celltree::compute_sum() { // Returns total sum of all elements
+    // Only the subtrees of dirty cells are recomputed, their sums reach the cell tree in one update
+    if (!dirty_cells.empty()) {
+        dirty_sums.resize(dirty_cells.size());
+        for (unsigned long k = 0; k < dirty_cells.size(); k++) {
+            Cell &cell = cells[dirty_cells[k]];
+            dirty_sums[k] = cell.rates.compute_sum();
+            cell.dirty = false;
+        }
+        cell_tree.setrates(&dirty_cells[0], &dirty_sums[0], dirty_cells.size());
+        dirty_cells.clear();
+    }
+    return cell_tree.compute_sum();
+}
+
+// Search returns index to element i: sum(0..i) <= searchkey < sum(0..i+1),
+// where the sum runs over the cells first (same convention as Bsumtree).
+long Celltree::search(double searchkey) { // Returns index to element
+    unsigned long icell = cell_tree.search_relative(searchkey);
+    Cell &cell = cells[icell];
+    if (cell.blocks.empty()) { return 0; } // all rates are 0
+    unsigned long i = cell.rates.search(searchkey);
+    unsigned long slot = i/block_size;
+    return cell.blocks[slot]*block_size + i - slot*block_size;
+}
+
+void Celltree::resize(unsigned long newsize) {
+    /*
+     *  When newsize >= oldsize: all elements are kept, new blocks start in cell 0 with rates 0.
+     *  When newsize < oldsize: excess elements are removed from their cells and thrown away.
+     */
+    unsigned long oldblocks = block_cell.size();
+    unsigned long nrblocks = (newsize + block_size - 1)/block_size;
+    for (unsigned long i = newsize; i < nrelements && i < nrblocks*block_size; i++) { // partial last block
+        setrate(i, 0.0);
+    }
+    for (unsigned long block = oldblocks; block > nrblocks; block--) {
+        Remove_from_cell(block-1);
+    }
+    block_cell.resize(nrblocks, 0);
+    block_slot.resize(nrblocks, 0);
+    for (unsigned long block = oldblocks; block < nrblocks; block++) {
+        Add_to_cell(block, 0);
+    }
+    nrelements = newsize;
+}
+
+long Celltree::getnrrates() {
+    return nrelements;
+}
+
+void Celltree::set_cell(unsigned long block, unsigned long cell) {
+    // Moves the block with its current rates, so pending and later setrate calls are unaffected
+    if (block_cell[block] == cell) { return; }
+    if (cell >= cells.size()) { Add_cells(cell + 1 - cells.size()); }
+    vector<double> rates(block_size);
+    for (unsigned long slot = 0; slot < block_size; slot++) { rates[slot] = getrate(block*block_size + slot); }
+    Remove_from_cell(block);
+    Add_to_cell(block, cell);
+    for (unsigned long slot = 0; slot < block_size; slot++) {
+        if (rates[slot] != 0.0) { setrate(block*block_size + slot, rates[slot]); }
+    }
+}
+
+void Celltree::Add_cells(unsigned long nrcells) {
+    for (unsigned long k = 0; k < nrcells; k++) {
+        Cell newcell;
+        newcell.rates.Set_block_size(block_size);
+        newcell.rates.initialize(0);
+        newcell.dirty = false;
+        cells.push_back(newcell);
+    }
+    cell_tree.resize(cells.size());
+}
+
+void Celltree::Add_to_cell(unsigned long block, unsigned long icell) {
+    Cell &cell = cells[icell];
+    block_cell[block] = icell;
+    block_slot[block] = cell.blocks.size();
+    cell.blocks.push_back(block);
+    cell.rates.resize(cell.blocks.size()*block_size); // new slots have rate 0
+}
+
+void Celltree::Remove_from_cell(unsigned long block) { // Swap-remove, the last block of the cell takes the free slot
+    Cell &cell = cells[block_cell[block]];
+    unsigned long slot = block_slot[block];
+    unsigned long lastslot = cell.blocks.size()-1;
+    unsigned long lastblock = cell.blocks[lastslot];
+    for (unsigned long jump = 0; jump < block_size; jump++) {
+        cell.rates.setrate(slot*block_size + jump, cell.rates.getrate(lastslot*block_size + jump));
+    }
+    cell.blocks[slot] = lastblock;
+    block_slot[lastblock] = slot;
+    cell.blocks.pop_back();
+    cell.rates.resize(cell.blocks.size()*block_size);
+    if (!cell.dirty) {
+        cell.dirty = true;
+        dirty_cells.push_back(block_cell[block]);
+    }
+}
+
+}}
+
+#endif
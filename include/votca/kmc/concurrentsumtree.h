@@ -0,0 +1,232 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_CONCURRENTSUMTREE_H_
+#define __VOTCA_KMC_CONCURRENTSUMTREE_H_
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+#include <votca/kmc/ratetree.h>
+
+// Binary partial sum tree (same layout as Bsumtree) with exact sums.
+// Partial sums are 128 bit fixed point numbers (64 bit integer part, 64 bit fraction) of the rates scaled
+// by 2^scale, stored as two atomic words. A setrate adds the exact difference to all ancestors with atomic
+// adds; integer addition is associative, so the sums (and every search) are bitwise identical whatever
+// the order of the updates.
+// By default rates from 2^-64 to 2^63 are representable. Set_rate_range moves that window to the rates of
+// the simulation. Nonzero rates below the window are dropped to 0 (they are at most 2^-95 of the largest
+// rate), rates above it throw instead of overflowing.
+//
+// The atomic adds let setrate run concurrently on different leaves (leaves owned, e.g. per carrier), with
+// compute_sum/search/resize/initialize not overlapping the updates. The engine does not rely on this: the
+// rate sweeps merge their per-worker Ratebatches from one thread.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Concurrentsumtree : public Ratetree {
+public:
+    Concurrentsumtree() : partsum_array(NULL), treesize(0), nrelements(0), scale(0) {}
+    ~Concurrentsumtree() { delete[] partsum_array; }
+
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+
+    // Largest rate that will be set, call before initialize. The sums keep 2^32 times that as headroom,
+    // the smallest nonzero rate is then max_rate*2^-95.
+    void Set_rate_range(double max_rate);
+
+private:
+    struct Fixed { // 128 bit fixed point value, hi is the integer part
+        uint64_t hi;
+        uint64_t lo;
+    };
+    struct Atomic_fixed {
+        atomic<uint64_t> hi;
+        atomic<uint64_t> lo;
+    };
+
+    Fixed To_fixed(double value);
+    double To_double(Fixed value);
+    Fixed partsum(unsigned long i);
+    void Allocate(unsigned long treesize);
+
+    Atomic_fixed* partsum_array; // Array of partial sums
+    vector<Fixed> element_fixed; // The elements in fixed point
+    vector<double> element_array; // The elements as they were set
+    unsigned long treesize;
+    unsigned long nrelements;
+    int scale; // The fixed point values are the rates times 2^scale
+};
+
+void Concurrentsumtree::Set_rate_range(double max_rate) {
+    if (!(max_rate > 0.0) || std::isinf(max_rate)) { throw runtime_error("Concurrentsumtree: invalid maximum rate"); }
+    scale = 30 - ilogb(max_rate); // max_rate*2^scale < 2^31
+}
+
+void Concurrentsumtree::initialize(unsigned long nrelements) { // Must be called before use
+    this->nrelements = nrelements;
+    unsigned long newtreesize = 1;
+    while (newtreesize+1 < nrelements) {
+        newtreesize = 2*newtreesize+1; // number of nodes
+    }
+    Allocate(newtreesize);
+    Fixed zero = {0, 0};
+    element_fixed.assign(nrelements, zero);
+    element_array.assign(nrelements, 0.0);
+}
+
+void Concurrentsumtree::setrate(unsigned long i, double value) { // 0 <= i < nrelements, leaf i owned by the caller
+    if (value > 0.0 && ldexp(value, scale) >= ldexp(1.0, 63)) {
+        throw runtime_error("Concurrentsumtree: rate above the fixed point range, adjust it with Set_rate_range");
+    }
+    Fixed newvalue = To_fixed(value);
+    Fixed oldvalue = element_fixed[i];
+    element_fixed[i] = newvalue;
+    element_array[i] = (newvalue.hi == 0 && newvalue.lo == 0) ? 0.0 : value; // rates below the window are dropped
+
+    // difference in two's complement, carried over 128 bits
+    uint64_t delta_lo = newvalue.lo - oldvalue.lo;
+    uint64_t delta_hi = newvalue.hi - oldvalue.hi - (newvalue.lo < oldvalue.lo ? 1 : 0);
+    if (delta_lo == 0 && delta_hi == 0) { return; }
+
+    unsigned long j = i + treesize;
+    while (j != 0) {
+        j = (j-1)/2; // Parent node
+        uint64_t old_lo = partsum_array[j].lo.fetch_add(delta_lo, memory_order_relaxed);
+        uint64_t carry = (old_lo + delta_lo < old_lo) ? 1 : 0;
+        partsum_array[j].hi.fetch_add(delta_hi + carry, memory_order_relaxed);
+    }
+}
+
+double Concurrentsumtree::getrate(long i) {
+    return element_array[i];
+}
+
+double Concurrentsumtree::compute_sum() { // Returns total sum of all elements, sums are always up to date
+    return To_double(partsum(0));
+}
+
+// Search returns index to element i: sum(0..i) <= searchkey < sum(0..i+1),
+// where the sum is taken over the succesive elements (same convention as Bsumtree).
+long Concurrentsumtree::search(double searchkey) { // Returns index to element
+    Fixed key = To_fixed(searchkey);
+    unsigned long i = 0;
+    while (i < treesize) {
+        Fixed left = partsum(2*i+1);
+        if (key.hi < left.hi || (key.hi == left.hi && key.lo <= left.lo)) { // value is located in left subtree
+            i = 2*i+1;
+        }
+        else { // value is located in right subtree, values are relative
+            uint64_t borrow = (key.lo < left.lo) ? 1 : 0;
+            key.lo -= left.lo;
+            key.hi -= left.hi + borrow;
+            i = 2*i+2;
+        }
+    }
+    i -= treesize;
+    if (i >= nrelements) { i = nrelements-1; } // key rounded past the last element
+    return i;
+}
+
+void Concurrentsumtree::resize(unsigned long newsize) { // Not thread safe
+    /*
+     *  When newsize >= oldsize: all elements are kept, new elements are 0. The tree is rebuilt
+     *  only when the leaf level runs out of capacity, and then doubles it.
+     *  When newsize < oldsize: excess elements are set to 0 and thrown away.
+     */
+    for (unsigned long i=newsize;i<nrelements;i++) {
+        setrate(i, 0.0);
+    }
+    Fixed zero = {0, 0};
+    element_fixed.resize(newsize, zero);
+    element_array.resize(newsize, 0.0);
+    nrelements = newsize;
+
+    if (treesize+1 < newsize) {
+        unsigned long newtreesize = treesize;
+        while (newtreesize+1 < newsize) {
+            newtreesize = 2*newtreesize+1;
+        }
+        Allocate(newtreesize);
+        for (unsigned long j=treesize;j>0;j--) { // bottom up rebuild, exact in fixed point
+            Fixed left = partsum(2*j-1);
+            Fixed right = partsum(2*j);
+            uint64_t lo = left.lo + right.lo;
+            partsum_array[j-1].lo.store(lo, memory_order_relaxed);
+            partsum_array[j-1].hi.store(left.hi + right.hi + (lo < left.lo ? 1 : 0), memory_order_relaxed);
+        }
+    }
+}
+
+long Concurrentsumtree::getnrrates() {
+    return nrelements;
+}
+
+Concurrentsumtree::Fixed Concurrentsumtree::To_fixed(double value) {
+    Fixed fixed = {0, 0};
+    if (value <= 0.0) { return fixed; }
+    double scaled = ldexp(value, scale);
+    if (scaled >= ldexp(1.0, 64)) { // only search keys get here (rates are checked in setrate), saturate
+        fixed.hi = ~(uint64_t) 0;
+        fixed.lo = ~(uint64_t) 0;
+        return fixed;
+    }
+    double integer = floor(scaled);
+    fixed.hi = (uint64_t) integer;
+    fixed.lo = (uint64_t) ldexp(scaled - integer, 64); // exact for the fraction of a double, truncates below 2^-64
+    return fixed;
+}
+
+double Concurrentsumtree::To_double(Fixed value) {
+    return ldexp((double) value.hi + ldexp((double) value.lo, -64), -scale);
+}
+
+Concurrentsumtree::Fixed Concurrentsumtree::partsum(unsigned long i) {
+    Fixed sum = {0, 0};
+    if (i < treesize) {
+        sum.hi = partsum_array[i].hi.load(memory_order_relaxed);
+        sum.lo = partsum_array[i].lo.load(memory_order_relaxed);
+    }
+    else if (i < treesize + nrelements) {
+        sum = element_fixed[i-treesize];
+    }
+    return sum; // Non-existent nodes have partial rate sum equal to 0
+}
+
+void Concurrentsumtree::Allocate(unsigned long treesize) {
+    delete[] partsum_array;
+    partsum_array = new Atomic_fixed[treesize];
+    for (unsigned long j=0;j<treesize;j++) {
+        partsum_array[j].hi.store(0, memory_order_relaxed);
+        partsum_array[j].lo.store(0, memory_order_relaxed);
+    }
+    this->treesize = treesize;
+}
+
+}}
+
+#endif
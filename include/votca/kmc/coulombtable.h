@@ -0,0 +1,233 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_COULOMBTABLE_H_
+#define __VOTCA_KMC_COULOMBTABLE_H_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <votca/tools/thread.h>
+#include <votca/kmc/graph.h>
+#include <votca/kmc/cellmesh.h>
+#include <votca/kmc/globaleventinfo.h>
+
+// Short range Coulomb potentials between all node pairs within coulcut, precomputed once.
+// Carriers only sit on nodes and the graph is static, so the potential a charge on one node
+// causes on another (including the electrode image series in a device) never changes.
+// Row i of the CSR table holds every node within coulcut of node i, sorted by node index, with the
+// potential at node i due to a unit charge on that node. Jump targets are nodes as well, so the same
+// table serves the potentials at the jump targets.
+// The table is only built when every periodic box length exceeds 2*coulcut (at most one image
+// of a node is within the cutoff) and it fits in the memory budget, lookups fail otherwise.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Coulombtable {
+public:
+    Coulombtable() : built(false) {}
+
+    // Returns false (and keeps no table) when the table cannot be used or does not fit in memory_budget bytes
+    bool Build(Graph* graph, Globaleventinfo* globevent, int nthreads, double memory_budget);
+    bool Built() { return built; }
+
+    // Potential at target_node due to a unit charge on source_node, false if the pair is not in the table
+    bool Lookup(int source_node, int target_node, double &potential);
+
+    // Potential at distance dif from a unit charge at x-coordinate startx, with the electrode image series in a device
+    static double Compute_potential(double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent);
+
+private:
+    // Computes the rows first_row..last_row-1, counting the entries only or filling the table
+    class Worker : public votca::tools::Thread {
+    public:
+        Worker(Coulombtable* table, Cellmesh mesh, long first_row, long last_row, bool count_only) :
+            table(table), mesh(mesh), first_row(first_row), last_row(last_row), count_only(count_only) {}
+        void Run(void);
+    private:
+        Coulombtable* table;
+        Cellmesh mesh; // own copy, Gather writes into the mesh
+        long first_row;
+        long last_row;
+        bool count_only;
+    };
+
+    void Run_workers(Cellmesh &mesh, int nthreads, bool count_only);
+
+    Graph* graph;
+    Globaleventinfo* globevent;
+    bool built;
+    vector<long> row_start; // First entry of every row, nrnodes+1 entries
+    vector<int> column; // Source node of every entry
+    vector<double> potential;
+};
+
+bool Coulombtable::Build(Graph* graph, Globaleventinfo* globevent, int nthreads, double memory_budget) {
+
+    this->graph = graph;
+    this->globevent = globevent;
+    built = false;
+    row_start.clear(); column.clear(); potential.clear();
+
+    double RC = globevent->coulcut;
+    myvec box = graph->sim_box_size;
+    if ((!globevent->device && box.x() <= 2.0*RC) || box.y() <= 2.0*RC || box.z() <= 2.0*RC) { return false; }
+    if (nthreads < 1) { nthreads = 1; }
+
+    Cellmesh mesh;
+    mesh.Initialize(box, RC, RC, !globevent->device);
+    for (unsigned int inode = 0; inode < graph->nodes.size(); inode++) {
+        mesh.Add(0, graph->nodes[inode]->node_ID, graph->nodes[inode]->node_position);
+    }
+
+    // Count the entries per row first, so the budget is checked before anything big is allocated
+    row_start.assign(graph->nodes.size()+1, 0);
+    Run_workers(mesh, nthreads, true);
+    for (unsigned int inode = 0; inode < graph->nodes.size(); inode++) {
+        row_start[inode+1] += row_start[inode];
+    }
+    long nrentries = row_start[graph->nodes.size()];
+    if (nrentries*(sizeof(int) + sizeof(double)) > memory_budget) {
+        row_start.clear();
+        return false;
+    }
+
+    column.resize(nrentries);
+    potential.resize(nrentries);
+    Run_workers(mesh, nthreads, false);
+    built = true;
+    return true;
+}
+
+inline bool Coulombtable::Lookup(int source_node, int target_node, double &potential) {
+    if (!built || target_node < 0 || target_node+1 >= (long) row_start.size()) { return false; }
+    const int* first = &column[0] + row_start[target_node];
+    const int* last = &column[0] + row_start[target_node+1];
+    const int* entry = lower_bound(first, last, source_node);
+    if (entry == last || *entry != source_node) { return false; }
+    potential = this->potential[entry - &column[0]];
+    return true;
+}
+
+void Coulombtable::Run_workers(Cellmesh &mesh, int nthreads, bool count_only) {
+    long nrnodes = graph->nodes.size();
+    vector<Worker*> workers;
+    for (int id = 0; id < nthreads; id++) {
+        workers.push_back(new Worker(this, mesh, id*nrnodes/nthreads, (id+1)*nrnodes/nthreads, count_only));
+    }
+    for (int id = 0; id < nthreads; id++) { workers[id]->Start(); }
+    for (int id = 0; id < nthreads; id++) { workers[id]->WaitDone(); }
+    for (int id = 0; id < nthreads; id++) { delete workers[id]; }
+}
+
+void Coulombtable::Worker::Run(void) {
+
+    Graph* graph = table->graph;
+    vector<pair<int,double> > row;
+
+    for (long irow = first_row; irow < last_row; irow++) {
+        Node* target = graph->nodes[irow];
+        myvec targetpos = target->node_position;
+        mesh.Gather(targetpos);
+
+        row.clear();
+        for (unsigned int ifound = 0; ifound < mesh.found_ID.size(); ifound++) {
+            int source_ID = mesh.found_ID[ifound];
+            if (source_ID == target->node_ID) { continue; } // charges on the same node do not interact
+            if (count_only) {
+                row.push_back(make_pair(source_ID, 0.0));
+                continue;
+            }
+            myvec sourcepos = myvec(mesh.found_x[ifound], mesh.found_y[ifound], mesh.found_z[ifound]);
+            row.push_back(make_pair(source_ID, Compute_potential(sourcepos.x(), targetpos-sourcepos,
+                                                                  graph->sim_box_size, table->globevent)));
+        }
+
+        if (count_only) {
+            table->row_start[irow+1] = row.size();
+            continue;
+        }
+        sort(row.begin(), row.end());
+        long entry = table->row_start[irow];
+        for (unsigned int k = 0; k < row.size(); k++) {
+            table->column[entry+k] = row[k].first;
+            table->potential[entry+k] = row[k].second;
+        }
+    }
+}
+
+double Coulombtable::Compute_potential(double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent) {
+
+    double coulpot;
+    double RC = globevent->coulcut;
+    double RCSQR = RC*RC;
+
+    if(!globevent->device) {
+        coulpot = 1.0/abs(dif)-1.0/RC;
+    }
+    else {
+        coulpot = 1.0/abs(dif)-1.0/RC; // self image potential is taken into account elsewhere
+
+        double L = sim_box_size.x();
+        double distsqr_planar = dif.y()*dif.y() + dif.z()*dif.z();
+        //double distsqr = dif.x()*dif.x() + distsqr_planar;
+
+        int sign;
+        double distx_1;
+        double distx_2;
+        double distancesqr_1;
+        double distancesqr_2;
+        bool outside_cut_off1 = false;
+        bool outside_cut_off2 = false;
+
+        while(!(outside_cut_off1&&outside_cut_off2)) {
+            for (int i=0;i<globevent->nr_sr_images; i++) {
+                if (div(i,2).rem==0) { // even generation
+                    sign = -1;
+                    distx_1 = i*L + 2*startx + dif.x();
+                    distx_2 = (i+2)*L - 2*startx - dif.x();
+                }
+                else {
+                    sign = 1;
+                    distx_1 = (i+1)*L + dif.x();
+                    distx_2 = (i+1)*L - dif.x();
+                }
+                distancesqr_1 = distx_1*distx_1 + distsqr_planar;
+                if (distancesqr_1<=RCSQR) {
+                    coulpot += sign*1.0/sqrt(distancesqr_1)-1.0/(RC);
+                }
+                else {
+                    outside_cut_off1 = true;
+                }
+                distancesqr_2 = distx_2*distx_2 + distsqr_planar;
+                if (distancesqr_2<=RCSQR) {
+                    coulpot += sign*1.0/sqrt(distancesqr_2)-1.0/(RC);
+                }
+                else {
+                    outside_cut_off2 = true;
+                }
+            }
+        }
+    }
+    return coulpot;
+}
+
+}}
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_CRSAMPLER_H_
+#define __VOTCA_KMC_CRSAMPLER_H_
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <votca/tools/random2.h>
+#include <votca/kmc/ratetree.h>
+
+// Composition-rejection sampler
+// Rates are binned in power-of-two classes [2^(e-1),2^e). The class is chosen with the search key
+// (composition over the class sums), the element within the class by rejection against 2^e,
+// which is accepted with probability >= 1/2. Selection and update are independent of the number of
+// elements, the cost only depends on the number of classes (the span of rates in orders of magnitude).
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Crsampler : public Ratetree {
+public:
+    Crsampler() : nrelements(0) {}
+
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+
+    // Own stream of random numbers for the rejection step within a class, so that searching
+    // does not shift the draws of the caller's generator
+    void Set_seed(int seed1, int seed2, int seed3, int seed4) { RandomVariable.init(seed1, seed2, seed3, seed4); }
+
+private:
+    struct Rate_class {
+        double upper; // 2^e, upper bound of all rates in this class
+        double sum;
+        long nr_updates; // number of incremental updates since sum was last recomputed
+        vector<unsigned long> members;
+    };
+
+    int Class_of(double value);
+    void Remove_from_class(unsigned long i);
+    void Add_to_class(unsigned long i, int iclass);
+
+    votca::tools::Random2 RandomVariable;
+    vector<Rate_class> classes;
+    vector<int> class_lookup; // exponent -> class index, -1 if not yet used
+    vector<double> element_array; // The elements (rates)
+    vector<int> class_array; // Class of every element, -1 for rate 0
+    vector<unsigned long> position_array; // Position of every element within its class
+    unsigned long nrelements;
+};
+
+void Crsampler::initialize(unsigned long nrelements) { // Must be called before use
+    this->nrelements = nrelements;
+    classes.clear();
+    class_lookup.assign(DBL_MAX_EXP - DBL_MIN_EXP + DBL_MANT_DIG + 1, -1); // all exponents frexp can return
+    element_array.assign(nrelements, 0.0);
+    class_array.assign(nrelements, -1);
+    position_array.assign(nrelements, 0);
+}
+
+void Crsampler::setrate(unsigned long i, double value) { // 0 <= i < nrelements
+    int newclass = (value > 0.0) ? Class_of(value) : -1;
+    int oldclass = class_array[i];
+    if (newclass == oldclass) {
+        if (newclass != -1) {
+            Rate_class &rate_class = classes[newclass];
+            rate_class.sum += value - element_array[i];
+            rate_class.nr_updates++;
+        }
+        element_array[i] = value;
+    }
+    else {
+        if (oldclass != -1) { Remove_from_class(i); }
+        element_array[i] = value;
+        if (newclass != -1) { Add_to_class(i, newclass); }
+    }
+}
+
+double Crsampler::getrate(long i) {
+    return element_array[i];
+}
+
+double Crsampler::compute_sum() { // Returns total sum of all elements
+    double sum = 0.0;
+    for (unsigned int iclass = 0; iclass < classes.size(); iclass++) {
+        Rate_class &rate_class = classes[iclass];
+        // Incremental updates accumulate round-off, recompute once per class size worth of updates (amortised O(1))
+        if (rate_class.nr_updates > (long) rate_class.members.size()) {
+            rate_class.sum = 0.0;
+            for (unsigned long imember = 0; imember < rate_class.members.size(); imember++) {
+                rate_class.sum += element_array[rate_class.members[imember]];
+            }
+            rate_class.nr_updates = 0;
+        }
+        sum += rate_class.sum;
+    }
+    return sum;
+}
+
+long Crsampler::search(double searchkey) { // Returns index to element
+
+    // composition: pick the rate class with the search key
+    int chosen = -1;
+    for (unsigned int iclass = 0; iclass < classes.size(); iclass++) {
+        if (classes[iclass].members.empty()) { continue; }
+        chosen = iclass;
+        if (searchkey <= classes[iclass].sum) { break; }
+        searchkey -= classes[iclass].sum;
+    }
+    if (chosen == -1) { return 0; } // all rates are 0
+
+    // rejection: draw members uniformly, accept with probability rate/2^e
+    Rate_class &rate_class = classes[chosen];
+    unsigned long nrmembers = rate_class.members.size();
+    while (true) {
+        double u = RandomVariable.rand_uniform()*nrmembers;
+        unsigned long imember = (unsigned long) u;
+        if (imember >= nrmembers) { imember = nrmembers-1; }
+        unsigned long i = rate_class.members[imember];
+        if ((u - imember)*rate_class.upper < element_array[i]) { // fractional part is a fresh uniform number
+            return i;
+        }
+    }
+}
+
+void Crsampler::resize(unsigned long newsize) { // O(1) per added or removed element
+    /*
+     *  When newsize >= oldsize: all elements are kept, new elements are 0.
+     *  When newsize < oldsize: excess elements are removed from their classes and thrown away.
+     */
+    for (unsigned long i = newsize; i < nrelements; i++) {
+        setrate(i, 0.0);
+    }
+    element_array.resize(newsize, 0.0);
+    class_array.resize(newsize, -1);
+    position_array.resize(newsize, 0);
+    nrelements = newsize;
+}
+
+long Crsampler::getnrrates() {
+    return nrelements;
+}
+
+int Crsampler::Class_of(double value) {
+    int exponent;
+    frexp(value, &exponent); // value = m*2^exponent, 0.5 <= m < 1
+    int &lookup = class_lookup[exponent - DBL_MIN_EXP + DBL_MANT_DIG];
+    if (lookup == -1) {
+        Rate_class newclass;
+        newclass.upper = ldexp(1.0, exponent);
+        newclass.sum = 0.0;
+        newclass.nr_updates = 0;
+        classes.push_back(newclass);
+        lookup = classes.size()-1;
+    }
+    return lookup;
+}
+
+void Crsampler::Remove_from_class(unsigned long i) { // O(1) swap-remove
+    Rate_class &rate_class = classes[class_array[i]];
+    unsigned long last = rate_class.members.back();
+    rate_class.members[position_array[i]] = last;
+    position_array[last] = position_array[i];
+    rate_class.members.pop_back();
+    if (rate_class.members.empty()) {
+        rate_class.sum = 0.0;
+        rate_class.nr_updates = 0;
+    }
+    else {
+        rate_class.sum -= element_array[i];
+        rate_class.nr_updates++;
+    }
+    class_array[i] = -1;
+}
+
+void Crsampler::Add_to_class(unsigned long i, int iclass) {
+    Rate_class &rate_class = classes[iclass];
+    position_array[i] = rate_class.members.size();
+    rate_class.members.push_back(i);
+    rate_class.sum += element_array[i];
+    rate_class.nr_updates++;
+    class_array[i] = iclass;
+}
+
+}}
+
+#endif
@@ -21,222 +21,197 @@
 #include <votca/kmc/state.h>
 #include <votca/kmc/graph.h>
 #include <votca/kmc/globaleventinfo.h>
+#include <votca/kmc/rateformalism.h>
+#include <votca/kmc/eventtypes.h>
 
 namespace votca { namespace kmc {
   
 using namespace std;
 
-enum From_step_event {Fromtransfer, Injection, Fromnotinbox};
-enum To_step_event {Totransfer, Recombination, Collection, Blocking, Tonotinbox};
+// What the events of a group start from: a carrier, an electrode (injection) or an empty node pair (generation)
+enum Event_source {Carrier_source, Electrode_source, Node_source};
 
 /*
- * Abstract base class for all events  
+ * The events of one group (electron or hole, injection or not, generation) as a structure of arrays indexed by event ID.
+ * Non-injection event IDs are carrier_ID*max_pair_degree + jump, injection event IDs run over the injectors of the
+ * left electrode first, then the right one, generation event IDs are node_ID*max_pair_degree + jump.
+ * Rates are only kept in the group's rate tree.
+ */
+class Eventtable {
+public:
+    Eventtable() : carrier_type(Electron), source(Carrier_source) {}
+
+    void Initialize(CarrierType carrier_type, Event_source source);
+    void Add_event(int jump, char electrode); // appends an event that is switched off
+    unsigned long Size() { return kind.size(); }
+
+    Event_kind Kind(long event_ID) { return (Event_kind) kind[event_ID]; }
+    void Set_kind(long event_ID, Event_kind kind) { this->kind[event_ID] = kind; }
+
+    CarrierType carrier_type;
+    Event_source source;
+
+    vector<char> kind; // Event_kind, selects the event type (eventtypes.h)
+    vector<int> jump; // Pair of the carrier's (or generation) node, the injector (pair of the electrode) for injection events
+    vector<char> electrode; // Injection events: 0 left, 1 right electrode
+};
+
+void Eventtable::Initialize(CarrierType carrier_type, Event_source source) {
+    this->carrier_type = carrier_type;
+    this->source = source;
+    kind.clear();
+    jump.clear();
+    electrode.clear();
+}
+
+void Eventtable::Add_event(int jump, char electrode) {
+    kind.push_back(Notinbox);
+    this->jump.push_back(jump);
+    this->electrode.push_back(electrode);
+}
+
+/*
+ * Rate and kind evaluation of the events, writing kinds into an Eventtable
  */
 class Event {
     
 public:
 
-    From_step_event fromtype;
-    To_step_event totype;
-    double rate;
-    Graph* graph;
-    
-    Carrier* carrier;
-    int tonode_ID;    
-    
-    Node* electrode;
-    CarrierType inject_cartype;
-    
-    void Set_injection_event(Node* electrode, int injectnode_ID, CarrierType carrier_type,
-                                 double from_longrange, double to_longrange, Globaleventinfo* globevent);
-    void Set_non_injection_event(vector<Node*> nodes, Carrier* carrier, int jump_ID,
+    // Sets the kind of an injection event and returns its rate
+    static double Set_injection_event(Eventtable &events, long event_ID, Node* electrode, int injectnode_ID, CarrierType carrier_type,
                                  double from_longrange, double to_longrange, Globaleventinfo* globevent);
     
+    // Sets the events of all jumps of a carrier at once, first_event_ID+jump for every pair of the carrier's node,
+    // rates[jump] receives the rates. to_longrange holds the longrange potential at every jump target.
+    // The rates are evaluated in one vectorised pass.
+    static void Set_non_injection_events(Eventtable &events, long first_event_ID, vector<Node*> &nodes, Carrier* carrier,
+                                 double from_longrange, const double* to_longrange, double* rates, Globaleventinfo* globevent);
+    
 private:
-    From_step_event Determine_non_injection_from_event_type(Carrier* carrier);
-    To_step_event Determine_non_injection_to_event_type(Carrier* carrier, int jumpID, Node* carriernode);
-    To_step_event Determine_injection_to_event_type(CarrierType carrier_type, Node* electrode, int inject_nodeID);
+    static Event_kind Determine_non_injection_event_kind(Carrier* carrier, int jumpID, Node* carriernode);
+    static Event_kind Determine_injection_event_kind(CarrierType carrier_type, Node* electrode, int inject_nodeID);
 
-    double Compute_event_rate(Node* fromnode, int jump_ID, CarrierType carrier_type,
-                            From_step_event from_event_type, To_step_event to_event_type,
+    static double Compute_event_rate(Node* fromnode, int jump_ID, CarrierType carrier_type, Event_kind kind,
                             double from_shortrange, double to_shortrange, double from_longrange, double to_longrange,
                             Globaleventinfo* globaleventinfo);
     
+    // Rates of jumps first_jump..first_jump+nrjumps-1 as plain transfers, to_shortrange and to_longrange per jump
+    static void Compute_jump_rates(Node* fromnode, CarrierType carrier_type, double from_shortrange, const double* to_shortrange,
+                            double from_longrange, const double* to_longrange, double* rates, int first_jump, int nrjumps,
+                            Globaleventinfo* globevent);
+    template <class Rate_formalism>
+    static void Compute_jump_rates(Node* fromnode, CarrierType carrier_type, double from_shortrange, const double* to_shortrange,
+                            double from_longrange, const double* to_longrange, double* rates, int first_jump, int nrjumps,
+                            Globaleventinfo* globevent);
+    
 };
 
-void Event::Set_injection_event(Node* electrode, int injectnode_ID, CarrierType carrier_type,
+double Event::Set_injection_event(Eventtable &events, long event_ID, Node* electrode, int injectnode_ID, CarrierType carrier_type,
                               double from_longrange, double to_longrange, Globaleventinfo* globevent) {
     
-    fromtype = Injection;
-    totype = Determine_injection_to_event_type(carrier_type, electrode, injectnode_ID);
-    rate = Compute_event_rate(electrode, injectnode_ID, carrier_type, fromtype, totype,
-                              0, 0.0, from_longrange, to_longrange, globevent);
-       
+    Event_kind kind = Determine_injection_event_kind(carrier_type, electrode, injectnode_ID);
+    events.Set_kind(event_ID, kind);
+    
+    // no Coulomb energy at the electrode, the injection potential of the target node takes the place of the shortrange part
+    double charge = (carrier_type == Electron) ? 1.0 : -1.0;
+    double to_shortrange = charge*electrode->pairing_nodes[injectnode_ID]->injection_potential;
+    return Compute_event_rate(electrode, injectnode_ID, carrier_type, kind, 0.0, to_shortrange, 0.0, to_longrange, globevent);
 }
 
-void Event::Set_non_injection_event(vector<Node*> nodes, Carrier* carrier, int jump_ID,
-                                 double from_longrange, double to_longrange, Globaleventinfo* globaleventinfo) {
+void Event::Set_non_injection_events(Eventtable &events, long first_event_ID, vector<Node*> &nodes, Carrier* carrier,
+                                 double from_longrange, const double* to_longrange, double* rates, Globaleventinfo* globevent) {
     
-    fromtype = Determine_non_injection_from_event_type(carrier);
-    totype = Determine_non_injection_to_event_type(carrier, jump_ID, nodes[carrier->carrier_node_ID]);
-    rate = Compute_event_rate(nodes[carrier->carrier_node_ID], jump_ID, carrier->carrier_type, fromtype, totype,
-                                     carrier->srfrom, carrier->srto[jump_ID], from_longrange, to_longrange,
-                                     globaleventinfo);    
+    Node* fromnode = nodes[carrier->carrier_node_ID];
+    int nrjumps = fromnode->pairing_nodes.size();
+    
+    Compute_jump_rates(fromnode, carrier->carrier_type, carrier->srfrom, &carrier->srto[0],
+                       from_longrange, to_longrange, rates, 0, nrjumps, globevent);
+    
+    for (int jump = 0; jump < nrjumps; jump++) {
+        Event_kind kind = Determine_non_injection_event_kind(carrier, jump, fromnode);
+        events.Set_kind(first_event_ID + jump, kind);
+        rates[jump] = Event_rate(kind, rates[jump], globevent);
+    }
 }
 
-double Event::Compute_event_rate(Node* fromnode, int jump_ID, CarrierType carrier_type,
-                                     From_step_event from_event_type, To_step_event to_event_type,
+double Event::Compute_event_rate(Node* fromnode, int jump_ID, CarrierType carrier_type, Event_kind kind,
                                      double from_shortrange, double to_shortrange, double from_longrange, double to_longrange,
                                      Globaleventinfo* globevent){
 
-    Node* jumptonode = fromnode->pairing_nodes[jump_ID];
+    double rate;
+    Compute_jump_rates(fromnode, carrier_type, from_shortrange, &to_shortrange, from_longrange, &to_longrange, &rate, jump_ID, 1, globevent);
+    return Event_rate(kind, rate, globevent);
+}
 
-    double prefactor = 1.0;
-    double charge;
-    double static_node_energy_from;
-    double static_node_energy_to;
-    
-    if(carrier_type == Electron) {
-        charge = 1.0;
-        prefactor *= globevent->electron_prefactor;
-        static_node_energy_from = fromnode->static_electron_node_energy;
-        static_node_energy_to = jumptonode->static_electron_node_energy; 
+void Event::Compute_jump_rates(Node* fromnode, CarrierType carrier_type, double from_shortrange, const double* to_shortrange,
+                            double from_longrange, const double* to_longrange, double* rates, int first_jump, int nrjumps,
+                            Globaleventinfo* globevent) {
+    
+    switch(globevent->formalism_type) {
+        case Marcus:
+            Compute_jump_rates<Marcus_formalism>(fromnode, carrier_type, from_shortrange, to_shortrange, from_longrange, to_longrange,
+                                                 rates, first_jump, nrjumps, globevent);
+            break;
+        case Custom:
+            Compute_jump_rates<Custom_formalism<0> >(fromnode, carrier_type, from_shortrange, to_shortrange, from_longrange, to_longrange,
+                                                     rates, first_jump, nrjumps, globevent);
+            break;
+        case Miller:
+        default:
+            Compute_jump_rates<Miller_formalism>(fromnode, carrier_type, from_shortrange, to_shortrange, from_longrange, to_longrange,
+                                                 rates, first_jump, nrjumps, globevent);
     }
-    else {
-        charge = -1.0;
-        prefactor *= globevent->hole_prefactor;
-        static_node_energy_from = fromnode->static_hole_node_energy;
-        static_node_energy_to = jumptonode->static_hole_node_energy;
-    }
-    
-    //first calculate quantum mechanical wavefunction overlap
-    myvec distancevector = fromnode->static_event_info[jump_ID].distance;
-    double distance = abs(distancevector);
-    
-    double distancefactor = exp(-1.0*globevent->alpha*distance);
-  
-    //second, calculate boltzmann factor (Coulomb interaction still have to be implemented)
-   
-    double init_energy;
-    double final_energy;
-    double selfimpot_from = fromnode->self_image_potential;
-    double selfimpot_to = jumptonode->self_image_potential;
-    double fromtype_energy = 0.0;
-    double totype_energy = 0.0;
-    
-    if(from_event_type == Injection) {
-        fromtype_energy -= globevent->injection_barrier;
-        prefactor *= globevent->injection_prefactor;
-    }
-    if(to_event_type == Recombination) {
-        totype_energy -= globevent->binding_energy;
-        prefactor *= globevent->recombination_prefactor;
-    }
-    if(to_event_type == Collection) {
-        totype_energy -= globevent->injection_barrier;
-        prefactor *= globevent->collection_prefactor;
-    }
-    
-    double coulomb_from;
-    double coulomb_to;
-    
-    if ((from_event_type != Injection)) { 
-        coulomb_from = globevent->coulomb_strength*(from_shortrange+charge*from_longrange);
-        coulomb_to = globevent->coulomb_strength*(to_shortrange+charge*to_longrange);
-    }
-    else {// if(from_event_type == Injection){
-        coulomb_from = 0.0;
-        coulomb_to = charge*globevent->coulomb_strength*(jumptonode->injection_potential+to_longrange);
-    }
-      
-    init_energy = static_node_energy_from + selfimpot_from + coulomb_from;
-    final_energy = static_node_energy_to + selfimpot_to + coulomb_to;
-    
-    double energycontrib;
-    double energyfactor;
-    
-    if (globevent->formalism == "Miller") {
-        if(to_event_type == Blocking) {
-            energyfactor = 0.0; // Keep this here for eventual simulation of bipolaron formation for example
-        }
-        else if((from_event_type == Fromnotinbox)&&(to_event_type == Tonotinbox)) {
-            energyfactor = 0.0; // Keep this here for eventual simulation of one-site events (on-node generation)
-        }
-        else {
-            energycontrib = final_energy - init_energy -charge*globevent->efield*distancevector.x();
-            if (energycontrib>0.0) {
-                energyfactor = exp(-1.0*globevent->beta*energycontrib);
-            }
-            else {
-                energyfactor = 1.0;
-            }
-        }
-    } else {
-      throw runtime_error("for globevent->formalism != Miller, energyfactor is undefined");
-    }
-    
-    double jump_rate = prefactor*distancefactor*energyfactor;
-    return jump_rate;    
 }
 
-From_step_event Event::Determine_non_injection_from_event_type(Carrier* carrier){
+template <class Rate_formalism>
+void Event::Compute_jump_rates(Node* fromnode, CarrierType carrier_type, double from_shortrange, const double* to_shortrange,
+                            double from_longrange, const double* to_longrange, double* rates, int first_jump, int nrjumps,
+                            Globaleventinfo* globevent) {
+
+    // Distance factor, prefactors, static energies, self image potentials and field are precomputed per jump
+    const double* static_factor = &fromnode->static_factor[carrier_type][first_jump];
+    const double* static_energy = &fromnode->static_energy[carrier_type][first_jump];
+    const double* reorg_energy = &fromnode->reorg_energy[carrier_type][first_jump];
     
-    From_step_event from_type;
+    double charge = (carrier_type == Electron) ? 1.0 : -1.0;
+    double coulomb_strength = globevent->coulomb_strength;
+    double beta = globevent->beta;
+    double from_coulomb = from_shortrange + charge*from_longrange;
     
-    if(!carrier->is_in_sim_box){
-        from_type = Fromnotinbox;
+    for (int k = 0; k < nrjumps; k++) {
+        double coulomb_energy = coulomb_strength*(to_shortrange[k] + charge*to_longrange[k] - from_coulomb); // final minus initial
+        rates[k] = static_factor[k]*Rate_formalism::Energy_factor(static_energy[k] + coulomb_energy, reorg_energy[k], beta);
     }
-    else {
-        from_type = Fromtransfer;
-    }
-    
-    return from_type;
-    
 }
 
-To_step_event Event::Determine_non_injection_to_event_type(Carrier* carrier, int jumpID, Node* carriernode){
+Event_kind Event::Determine_non_injection_event_kind(Carrier* carrier, int jumpID, Node* carriernode){
     
-    To_step_event to_type;
-    
-    if(!carrier->is_in_sim_box){
-        to_type = Tonotinbox;
+    if(!carrier->is_in_sim_box || jumpID >= (int) carriernode->pairing_nodes.size()) {
+        return Notinbox;
     }
-    else {
-        int node_degree = carriernode->pairing_nodes.size();
-        if(jumpID < node_degree) { // hopping event exists in graph
-            Node* jumpnode = carriernode->pairing_nodes[jumpID];
-            if(jumpnode->carriers_on_node.empty()){
-                to_type = Totransfer;
-            }
-            else if(jumpnode->carriers_on_node[0]->carrier_type == carrier->carrier_type) {
-                to_type = Blocking;
-            }
-            else{// if(jumpnode->carriers_on_node[0]->carrier_type != carrier->carrier_type) {
-                to_type = Recombination;
-            }
-        }
-        else {
-            to_type = Tonotinbox;
-        }
+    Node* jumpnode = carriernode->pairing_nodes[jumpID];
+    if(jumpnode->node_type != Normal) {
+        return Collection;
     }
-    
-    return to_type;
+    if(jumpnode->carriers_on_node.empty()){
+        return Transfer;
+    }
+    if(jumpnode->carriers_on_node[0]->carrier_type == carrier->carrier_type) {
+        return Blocking;
+    }
+    return Recombination;
 }
 
-To_step_event Event::Determine_injection_to_event_type(CarrierType carrier_type, Node* electrode, int inject_nodeID){
+Event_kind Event::Determine_injection_event_kind(CarrierType carrier_type, Node* electrode, int inject_nodeID){
     
     Node* injectnode = electrode->pairing_nodes[inject_nodeID];
     if(injectnode->carriers_on_node.empty()){
-        totype = Totransfer;
-    }
-    else if(injectnode->carriers_on_node[0]->carrier_type == carrier_type) {
-        totype = Blocking;
+        return Injection;
     }
-    else if(injectnode->carriers_on_node[0]->carrier_type != carrier_type) {
-        totype = Recombination;
+    if(injectnode->carriers_on_node[0]->carrier_type == carrier_type) {
+        return Blocking;
     }
-    
-    return totype;
+    return Injection_recombination;
 }
 
 
@@ -19,57 +19,176 @@
 #define __VOTCA_KMC_EVENTS_H_
 
 
+#include <votca/tools/thread.h>
 #include <votca/kmc/graph.h>
 #include <votca/kmc/state.h>
 #include <votca/kmc/event.h>
+#include <votca/kmc/ratetree.h>
 #include <votca/kmc/bsumtree.h>
+#include <votca/kmc/bnarytree.h>
+#include <votca/kmc/crsampler.h>
+#include <votca/kmc/concurrentsumtree.h>
+#include <votca/kmc/nextreactionqueue.h>
+#include <votca/kmc/twoleveltree.h>
+#include <votca/kmc/celltree.h>
 #include <votca/kmc/longrange.h>
+#include <votca/kmc/coulombtable.h>
+#include <votca/kmc/injectiontable.h>
+#include <votca/kmc/threadteam.h>
 #include <votca/kmc/globaleventinfo.h>
 
 namespace votca { namespace kmc {
   
 using namespace std;
 
-enum action{Add, Remove };
-
 class Events {
     
 public:
+    Events() : nthreads(1) {}
     
-    vector<Event*> El_non_injection_events;
-    vector<Event*> Ho_non_injection_events;
-    vector<Event*> El_injection_events;
-    vector<Event*> Ho_injection_events;
-    Bsumtree* El_non_injection_rates;
-    Bsumtree* Ho_non_injection_rates;
-    Bsumtree* El_injection_rates;
-    Bsumtree* Ho_injection_rates;
+    Eventtable El_non_injection_events;
+    Eventtable Ho_non_injection_events;
+    Eventtable El_injection_events;
+    Eventtable Ho_injection_events;
+    Eventtable Generation_events;
+    Ratetree* El_non_injection_rates;
+    Ratetree* Ho_non_injection_rates;
+    Ratetree* El_injection_rates;
+    Ratetree* Ho_injection_rates;
+    Ratetree* Generation_rates; // Static, set once by Initialize_generation, NULL when generation is off
+    Ratebatch El_non_injection_batch; // Rate updates of the current step, flushed in one pass
+    Ratebatch Ho_non_injection_batch;
+    Ratebatch El_injection_batch;
+    Ratebatch Ho_injection_batch;
     Longrange* longrange;
+    Coulombtable coulomb_table; // Precomputed short range pair potentials, direct computation when not built
     
     int nholes;
     int nelectrons;
     int ncarriers;
+    int nthreads; // Worker threads for the full rate sweeps (Recompute_all_*)
+    
+    void On_execute(Eventtable* events, long event_ID, Graph* graph, State* state, Globaleventinfo* globevent);
     
-    void On_execute(Event* event, Graph* graph, State* state, Globaleventinfo* globevent);
+    // State changes for the execute kernels of the event types (eventtypes.h)
+    void Add_remove_carrier(action AR, Carrier* carrier, Graph* graph, Node* action_node, State* state, Globaleventinfo* globevent);
+    Carrier* New_carrier(CarrierType carrier_type, Graph* graph, State* state, Globaleventinfo* globevent); // from the reservoir, not yet placed
+    void Delete_carrier(Carrier* carrier, State* state); // back to the reservoir, already removed from its node
 
     void Recompute_all_injection_events(Graph* graph, Globaleventinfo* globevent);
     void Recompute_all_non_injection_events(Graph* graph, State* state, Globaleventinfo* globevent);
   
+    void Flush_rate_batches();
+    void Initialize_ratetrees(Ratetree_type ratetree_type, votca::tools::Random2 *RandomVariable, Graph* graph, Globaleventinfo* globevent);
     void Initialize_eventvector(Graph* graph, State* state, Globaleventinfo* globevent);
     void Initialize_longrange(Graph* graph, Globaleventinfo* globevent);
+    void Initialize_coulomb_table(Graph* graph, Globaleventinfo* globevent, int nthreads, double memory_budget);
+    void Initialize_neighbour_team(Graph* graph, Globaleventinfo* globevent, int nthreads);
+    void Initialize_carriers(Graph* graph, State* state, Globaleventinfo* globevent);
+    void Initialize_generation(Graph* graph, State* state, Globaleventinfo* globevent);
     
     bool el_dirty;
     bool ho_dirty;
+    bool generation_dirty;
     
 private:
-    void Initialize_injection_eventvector(Node* electrode, vector<Event*> eventvector, CarrierType cartype);
-    void Grow_non_injection_eventvector(int carrier_grow_size, vector<Carrier*> carriers, vector<Event*> eventvector,int max_pair_degree);
+    Ratetree* Create_ratetree(Ratetree_type ratetree_type, votca::tools::Random2 *RandomVariable, int block_size, double max_rate);
+    double Max_event_rate(Graph* graph, Globaleventinfo* globevent);
+    void Initialize_injection_eventvector(Node* electrode, Eventtable &eventvector);
+    void Grow_non_injection_eventvector(int carrier_grow_size, Eventtable &eventvector, int max_pair_degree);
 
-    void Add_remove_carrier(action AR, Carrier* carrier, Graph* graph, Node* action_node, State* state, Globaleventinfo* globevent);
     void Effect_potential_and_non_injection_rates(action AR, Carrier* carrier, Graph* graph, State* state, Globaleventinfo* globevent);
-    void Effect_injection_rates(action AR, Graph* graph, Carrier* carrier, double dist_to_electrode, Node* electrode, Globaleventinfo* globevent);    
+    void Effect_neighbour(long ifound, action AR, Carrier* carrier, int interact_sign, Graph* graph, State* state, Globaleventinfo* globevent);
+    
+    // Optional team for the neighbour updates of a step, the carriers found by Gather are split in contiguous ranges
+    class Neighbour_task : public Teamtask {
+    public:
+        void Run_part(int part, int nrparts);
+        Events* events;
+        action AR;
+        Carrier* carrier;
+        int interact_sign;
+        Graph* graph;
+        State* state;
+        Globaleventinfo* globevent;
+        long nrfound;
+    };
+    static const long min_team_neighbours = 64; // fewer found carriers are not worth waking the team
+    Threadteam neighbour_team;
+    Neighbour_task neighbour_task;
+    // Per found carrier: contributions to the moving carrier's srfrom and srto (max_pair_degree per carrier), Neighbour_state
+    enum Neighbour_state {Not_neighbour = 0, Neighbour = 1, Touched_neighbour = 2};
+    vector<double> neighbour_srfrom;
+    vector<double> neighbour_srto;
+    vector<char> neighbour_state;
+    void Effect_injection_rates(action AR, Graph* graph, Carrier* carrier, Node* electrode, Globaleventinfo* globevent);    
+    void Touch_injector(Graph* graph, int injector_ID, Node* electrode, Globaleventinfo* globevent);
+    void Recompute_injection_potentials(Graph* graph, Globaleventinfo* globevent);
+    
+    Injectiontable left_injection_table; // Injectors within coulcut of the nodes next to each electrode
+    Injectiontable right_injection_table;
+    void Set_carrier_non_injection_events(Carrier* carrier, Graph* graph, Globaleventinfo* globevent);
+    void Set_carrier_non_injection_events(Carrier* carrier, Graph* graph, Globaleventinfo* globevent,
+                                          vector<double> &tolongrange, vector<double> &rates, Ratebatch &batch);
+    void Set_injection_event_rate(CarrierType carrier_type, int event_ID, Graph* graph, Globaleventinfo* globevent, Ratebatch &batch);
+    
+    // Carriers in the box, in no particular order. active_index holds the position of every carrier_ID, -1 if not in the box.
+    void Initialize_active_carriers(State* state);
+    void Activate_carrier(Carrier* carrier);
+    void Deactivate_carrier(Carrier* carrier);
+    vector<Carrier*> el_active;
+    vector<Carrier*> ho_active;
+    vector<int> el_active_index;
+    vector<int> ho_active_index;
+    
+    // Full sweeps split over threads, every worker collects its rates in its own batches,
+    // the batches are merged into the trees afterwards (in worker order, so the result does not depend on the threads)
+    enum Sweep {Carrier_rates, Injection_rates, Carrier_potentials};
+    class Recompute_worker : public votca::tools::Thread {
+    public:
+        Recompute_worker(Events* events, Graph* graph, State* state, Globaleventinfo* globevent, Sweep sweep, long first_job, long last_job) :
+            events(events), graph(graph), state(state), globevent(globevent), sweep(sweep), first_job(first_job), last_job(last_job) {
+            if(sweep == Carrier_potentials) mesh = state->coulomb_mesh; // own copy, Gather writes into the mesh
+        }
+        void Run(void);
+        Ratebatch el_batch;
+        Ratebatch ho_batch;
+    private:
+        Events* events;
+        Graph* graph;
+        State* state;
+        Globaleventinfo* globevent;
+        Sweep sweep; // jobs are injection events for Injection_rates, active carriers otherwise
+        long first_job;
+        long last_job;
+        vector<double> tolongrange;
+        vector<double> rates;
+        Cellmesh mesh;
+    };
+    void Run_recompute_workers(Graph* graph, State* state, Globaleventinfo* globevent, Sweep sweep);
+    void Compute_carrier_potentials(Carrier* carrier, Cellmesh &mesh, Graph* graph, State* state, Globaleventinfo* globevent);
+    
+    // Events touched during a step are recomputed once, at the end of On_execute. Carriers are refreshed as a whole
+    // (all jumps in one vectorised pass), removed carriers get their events switched off.
+    enum Touch_state {Untouched = 0, Touched = 1, Removed = 2};
+    void Touch_carrier(Carrier* carrier, Touch_state touch);
+    void Touch_injection_event(CarrierType carrier_type, int event_ID);
+    void Refresh_touched_events(Graph* graph, State* state, Globaleventinfo* globevent);
+    
+    vector<char> el_touched; // Touch_state per carrier_ID
+    vector<char> ho_touched;
+    vector<int> el_touched_IDs;
+    vector<int> ho_touched_IDs;
+    vector<char> el_injection_touched; // per injection event_ID
+    vector<char> ho_injection_touched;
+    vector<int> el_injection_touched_IDs;
+    vector<int> ho_injection_touched_IDs;
+    
+    vector<double> jump_tolongrange; // Scratch space, longrange potential at the jump targets of one carrier
+    vector<double> jump_rates; // Scratch space, rates of the jumps of one carrier
     
     double Compute_Coulomb_potential(double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent);
+    double Coulomb_potential(Node* source, Node* target, double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent);
 };
 
 void Events::Initialize_longrange(Graph* graph, Globaleventinfo* globevent) {
@@ -77,73 +196,77 @@ void Events::Initialize_longrange(Graph* graph, Globaleventinfo* globevent) {
     longrange->Initialize(graph,globevent); 
 }
 
-void Events::On_execute(Event* event, Graph* graph, State* state, Globaleventinfo* globevent) {
+void Events::Initialize_coulomb_table(Graph* graph, Globaleventinfo* globevent, int nthreads, double memory_budget) {
+    coulomb_table.Build(graph, globevent, nthreads, memory_budget);
+}
+
+void Events::On_execute(Eventtable* events, long event_ID, Graph* graph, State* state, Globaleventinfo* globevent) {
     
-    if(event->fromtype == Fromtransfer) {
-        Carrier* carrier = event->carrier;
-        Node* fromnode = graph->nodes[carrier->carrier_node_ID]; 
-        Node* tonode = fromnode->pairing_nodes[event->tonode_ID];
-        Add_remove_carrier(Remove,carrier,graph,fromnode,state,globevent);
+    Event_site site;
+    site.carrier_type = events->carrier_type;
+    site.graph = graph;
+    site.state = state;
+    site.globevent = globevent;
+    if(events->source == Electrode_source) {
+        site.carrier = NULL;
+        site.fromnode = (events->electrode[event_ID] == 0) ? graph->left_electrode : graph->right_electrode;
+    }
+    else if(events->source == Node_source) {
+        site.carrier = NULL;
+        site.fromnode = graph->nodes[event_ID/graph->max_pair_degree];
+    }
+    else {
+        vector<Carrier*> &carriers = (events->carrier_type == Electron) ? state->electrons : state->holes;
+        site.carrier = carriers[event_ID/graph->max_pair_degree];
+        site.fromnode = graph->nodes[site.carrier->carrier_node_ID];
+    }
+    site.tonode = site.fromnode->pairing_nodes[events->jump[event_ID]];
     
-        if(event->totype == Totransfer) {
-            Add_remove_carrier(Add,carrier,graph,tonode,state,globevent);
-        }
-        else if(event->totype == Recombination) {
-            Carrier* recombined_carrier = tonode->carriers_on_node[0];
-            Add_remove_carrier(Remove, recombined_carrier, graph, tonode,state,globevent);
-            if(carrier->carrier_type == Electron) {
-                state->Sell(state->electrons, state->electron_reservoir, carrier->carrier_ID);
-                state->Sell(state->holes, state->hole_reservoir, recombined_carrier->carrier_ID);
-            }
-            else if(carrier->carrier_type == Hole) {
-                state->Sell(state->holes, state->hole_reservoir, carrier->carrier_ID);
-                state->Sell(state->electrons, state->electron_reservoir, recombined_carrier->carrier_ID);
-            }
-        }
-        else if(event->totype == Collection) {
-            if(carrier->carrier_type == Electron) {
-                state->Sell(state->electrons, state->electron_reservoir, carrier->carrier_ID);
-            }
-            else if(carrier->carrier_type == Hole) {
-                state->Sell(state->holes, state->hole_reservoir, carrier->carrier_ID);
-            }            
+    Execute_event(events->Kind(event_ID), this, site);
+    
+    Refresh_touched_events(graph, state, globevent);
+    Flush_rate_batches();
+}
+
+Carrier* Events::New_carrier(CarrierType carrier_type, Graph* graph, State* state, Globaleventinfo* globevent) {
+    
+    int carrier_ID;
+    if(carrier_type == Electron) {
+        if(state->electron_reservoir.empty()){
+            state->Grow(state->electrons, state->electron_reservoir, globevent->state_grow_size, graph->max_pair_degree);
+            Grow_non_injection_eventvector(globevent->state_grow_size, El_non_injection_events, graph->max_pair_degree);
+            El_non_injection_rates->resize(El_non_injection_events.Size());
         }
+        carrier_ID = state->Buy(state->electrons, state->electron_reservoir);
+        state->electrons[carrier_ID]->carrier_type = Electron; // the reservoir does not know the type
+        return state->electrons[carrier_ID];
     }
-    else if(event->fromtype == Injection) {
-        Node* tonode = event->electrode->pairing_nodes[event->tonode_ID];
-        
-        if(event->totype == Totransfer) {
-            int carrier_ID;
-            if(event->inject_cartype == Electron) {
-                if(state->electron_reservoir.empty()){
-                    state->Grow(state->electrons, state->electron_reservoir, globevent->state_grow_size, graph->max_pair_degree);
-                    Grow_non_injection_eventvector(globevent->state_grow_size, state->electrons, El_non_injection_events,graph->max_pair_degree);
-                    El_non_injection_rates->resize(El_non_injection_events.size());
-                }
-                carrier_ID = state->Buy(state->electrons, state->electron_reservoir);
-                Add_remove_carrier(Add,state->electrons[carrier_ID],graph,tonode,state,globevent);
-            }
-            else if (event->inject_cartype == Hole) {
-                if(state->hole_reservoir.empty()){
-                    state->Grow(state->holes, state->hole_reservoir, globevent->state_grow_size, graph->max_pair_degree);
-                    Grow_non_injection_eventvector(globevent->state_grow_size, state->holes, Ho_non_injection_events,graph->max_pair_degree);
-                    Ho_non_injection_rates->resize(Ho_non_injection_events.size());
-                }  
-                carrier_ID = state->Buy(state->holes, state->hole_reservoir);
-                Add_remove_carrier(Add,state->holes[carrier_ID],graph,tonode,state,globevent);
-            }
-        }
-        else if(event->totype == Recombination) {
-            Carrier* recombined_carrier = tonode->carriers_on_node[0];
-            Add_remove_carrier(Remove,recombined_carrier,graph,tonode,state,globevent);
-            if(event->inject_cartype == Electron) {
-                state->Sell(state->holes, state->hole_reservoir, recombined_carrier->carrier_ID);
-            }
-            else if(event->inject_cartype == Hole) {
-                state->Sell(state->electrons, state->electron_reservoir, recombined_carrier->carrier_ID);
-            }                        
-        }
+    else {
+        if(state->hole_reservoir.empty()){
+            state->Grow(state->holes, state->hole_reservoir, globevent->state_grow_size, graph->max_pair_degree);
+            Grow_non_injection_eventvector(globevent->state_grow_size, Ho_non_injection_events, graph->max_pair_degree);
+            Ho_non_injection_rates->resize(Ho_non_injection_events.Size());
+        }  
+        carrier_ID = state->Buy(state->holes, state->hole_reservoir);
+        state->holes[carrier_ID]->carrier_type = Hole;
+        return state->holes[carrier_ID];
+    }
+}
+
+void Events::Delete_carrier(Carrier* carrier, State* state) {
+    if(carrier->carrier_type == Electron) {
+        state->Sell(state->electrons, state->electron_reservoir, carrier->carrier_ID);
     }
+    else {
+        state->Sell(state->holes, state->hole_reservoir, carrier->carrier_ID);
+    }
+}
+
+void Events::Flush_rate_batches() {
+    El_non_injection_batch.Flush(El_non_injection_rates);
+    Ho_non_injection_batch.Flush(Ho_non_injection_rates);
+    El_injection_batch.Flush(El_injection_rates);
+    Ho_injection_batch.Flush(Ho_injection_rates);
 }
 
 void Events::Add_remove_carrier(action AR, Carrier* carrier,Graph* graph, Node* action_node, State* state, Globaleventinfo* globevent){
@@ -160,7 +283,16 @@ void Events::Add_remove_carrier(action AR, Carrier* carrier,Graph* graph, Node*
         } 
         ncarriers++;
 
+        Activate_carrier(carrier);
         state->Add_to_coulomb_mesh(graph, carrier, globevent);
+
+        // keep the carrier's jumps in the rate subtree of its mesh cell (partitioned trees only)
+        if (carrier->carrier_type == Electron) {
+            El_non_injection_rates->set_cell(carrier->carrier_ID, state->Coulomb_mesh_cell(graph, carrier, globevent));
+        }
+        else if (carrier->carrier_type == Hole) {
+            Ho_non_injection_rates->set_cell(carrier->carrier_ID, state->Coulomb_mesh_cell(graph, carrier, globevent));
+        }
     }
     else if(AR == Remove) {
         action_node->carriers_on_node.pop_back();
@@ -172,6 +304,7 @@ void Events::Add_remove_carrier(action AR, Carrier* carrier,Graph* graph, Node*
             nelectrons--;
         }
         ncarriers--;
+        Deactivate_carrier(carrier);
     }
     
     Effect_potential_and_non_injection_rates(AR,carrier,graph,state, globevent);
@@ -180,13 +313,13 @@ void Events::Add_remove_carrier(action AR, Carrier* carrier,Graph* graph, Node*
     if(globevent->device){
         double dist_to_left_electrode = action_node->node_position.x();
         if(dist_to_left_electrode<graph->hopdist){
-            Effect_injection_rates(AR,graph,carrier,dist_to_left_electrode,graph->left_electrode,globevent);
+            Effect_injection_rates(AR,graph,carrier,graph->left_electrode,globevent);
         }
     
         // check proximity to right electrode
         double dist_to_right_electrode = graph->sim_box_size.x() - action_node->node_position.x();
         if(dist_to_right_electrode<graph->hopdist){
-            Effect_injection_rates(AR,graph,carrier,dist_to_right_electrode,graph->right_electrode, globevent);
+            Effect_injection_rates(AR,graph,carrier,graph->right_electrode, globevent);
         }
     }  
   
@@ -214,544 +347,727 @@ void Events::Effect_potential_and_non_injection_rates(action AR, Carrier* carrie
         int layer_index = carnode->layer_index;
         longrange->layercharge[layer_index] += interact_sign;
     }
-     
-    myvec carpos = carnode->node_position;
 
-    // Define cubic boundaries in non-periodic coordinates
-    double ix1 = carpos.x()-globevent->coulcut-graph->hopdist; double ix2 = carpos.x()+globevent->coulcut+graph->hopdist;
-    double iy1 = carpos.y()-globevent->coulcut-graph->hopdist; double iy2 = carpos.y()+globevent->coulcut+graph->hopdist;
-    double iz1 = carpos.z()-globevent->coulcut-graph->hopdist; double iz2 = carpos.z()+globevent->coulcut+graph->hopdist;
-
-    // Break periodicity in x-direction
-    if(globevent->device) {
-        if (ix1<0.0) ix1 = 0.0;
-        if (ix2>=graph->sim_box_size.x()) ix2 = graph->sim_box_size.x();
+    // Gather all charges within coulcut+hopdist (the moving carrier or one of its jump targets can interact with them),
+    // periodic images come back with non-periodic coordinates
+    Cellmesh &mesh = state->coulomb_mesh;
+    mesh.Gather(carnode->node_position);
+    long nrfound = mesh.found_ID.size();
+    
+    // Every found carrier updates its own potentials, its contributions to the moving carrier are summed afterwards in
+    // the order of the serial loop, so splitting the found carriers over the team gives the same trajectory
+    neighbour_srfrom.resize(nrfound);
+    neighbour_srto.resize(nrfound*graph->max_pair_degree);
+    neighbour_state.resize(nrfound);
+    
+    neighbour_task.events = this;
+    neighbour_task.AR = AR;
+    neighbour_task.carrier = carrier;
+    neighbour_task.interact_sign = interact_sign;
+    neighbour_task.graph = graph;
+    neighbour_task.state = state;
+    neighbour_task.globevent = globevent;
+    neighbour_task.nrfound = nrfound;
+    if(neighbour_team.Size() > 1 && nrfound >= min_team_neighbours) {
+        neighbour_team.Run(&neighbour_task);
+    }
+    else {
+        neighbour_task.Run_part(0, 1);
     }
-  
-    // Translate cubic boundaries to sublattice boundaries in non-periodic coordinates
-    int sx1 = floor(ix1/globevent->coulcut);
-    int sx2 = floor(ix2/globevent->coulcut);
-    int sy1 = floor(iy1/globevent->coulcut);
-    int sy2 = floor(iy2/globevent->coulcut);
-    int sz1 = floor(iz1/globevent->coulcut);
-    int sz2 = floor(iz2/globevent->coulcut);
-  
-    // Now visit all relevant sublattices
-    for (int isz=sz1; isz<=sz2; isz++) {
-        int r_isz = isz;
-        while (r_isz < 0) r_isz += state->meshsizeZ;
-        while (r_isz >= state->meshsizeZ) r_isz -= state->meshsizeZ;
-        for (int isy=sy1; isy<=sy2; isy++) {
-            int r_isy = isy;
-            while (r_isy < 0) r_isy += state->meshsizeY;
-            while (r_isy >= state->meshsizeY) r_isy -= state->meshsizeY;
-            for (int isx=sx1; isx<=sx2; isx++) {
-                int r_isx = isx;
-                while (r_isx < 0) r_isx += state->meshsizeX;
-                while (r_isx >= state->meshsizeX) r_isx -= state->meshsizeX;
-                for (int icartype = 0;icartype <2;icartype++) {
-                
-                    // Ask a list of all charges in this sublattice
-                    list<int>::iterator li1,li2,li3;
-                    list<int> *carrierList = &state->coulomb_mesh[r_isx][r_isy][r_isz][icartype];
-                    li1 = carrierList->begin();
-                    li2 = carrierList->end();
-                    for (li3=li1; li3!=li2; li3++) {
-                        int probecarrier_ID = *li3;
-                        Carrier* probecarrier;
-                        if(icartype == 0) {probecarrier = state->electrons[probecarrier_ID];}
-                        if(icartype == 1) {probecarrier = state->holes[probecarrier_ID];}
-                        Node* probenode = graph->nodes[probecarrier->carrier_node_ID];
-                        myvec probepos = probenode->node_position;
-                        int probecharge;
-                        if(icartype == 0) {
-                            probecharge = -1;
-                        }
-                        else {
-                            probecharge = 1;
-                        }
-          
-                        interact_sign *= probecharge;
-          
-                        // Compute coordinates in non-periodic lattice
-                        myvec periodic_convert = myvec((isx-r_isx)*globevent->coulcut,(isy-r_isy)*globevent->coulcut,(isz-r_isz)*globevent->coulcut);
-                        myvec np_probepos = probepos + periodic_convert;
-                        myvec distance = np_probepos-carpos;
-
-                        double distancesqr = abs(distance)*abs(distance);
-
-                        if (probecarrier_ID!=carrier->carrier_ID) {
-                            if((carnode->node_ID!=probenode->node_ID)&&(distancesqr<=globevent->coulcut*globevent->coulcut)) { 
-                                
-                                // Charge interacting with its own images, taken care off in graph.h
-                                // In case multiple charges are on the same node, coulomb calculation on the same spot is catched
-                          
-                                //First we take the direction sr interactions into account
-                                if (AR==Add) carrier->srfrom +=interact_sign*Compute_Coulomb_potential(np_probepos.x(),-1.0*distance,
-                                                            graph->sim_box_size,globevent);
-                                probecarrier->srfrom += interact_sign*Compute_Coulomb_potential(carpos.x(),distance,
-                                                            graph->sim_box_size,globevent);
-                            }
-                            if (AR==Add) {
-              
-                                // Adjust Coulomb potential for neighbours of the added carrier
-                                for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
-                                    myvec jumpdistancevector = carnode->static_event_info[jump].distance;
-                                    myvec jumpcarrierpos = carnode->node_position + jumpdistancevector;
-                                    myvec jumpdistance = np_probepos - jumpcarrierpos;
-                                    double distancejumpsqr = abs(jumpdistance)*abs(jumpdistance);
-
-                                    if(distancejumpsqr <= globevent->coulcut*globevent->coulcut) {
-                                    
-                                        carrier->srto[jump] += interact_sign*Compute_Coulomb_potential(np_probepos.x(),jumpdistance,
-                                                         graph->sim_box_size, globevent);
-                                    }
-                                }
-                            }
-                            else if (AR==Remove) {
-                            
-                                // Reset Coulomb potential for carrier1 and its neighbours
-                                carrier->srfrom = 0.0;
-                                for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
-                                    carrier->srto[jump] = 0.0;  
-                                }                            
-                            }
-           
-                            // Adjust Coulomb potential and event rates for neighbours of carrier2
-                            for (unsigned int jump=0; jump < probenode->pairing_nodes.size(); jump++) {
-                                myvec jumpdistancevector = probenode->static_event_info[jump].distance;
-                                myvec jumpprobepos = np_probepos+jumpdistancevector;
-                                myvec jumpdistance = carpos-jumpprobepos;
-                                double distsqr = abs(jumpdistance)*abs(jumpdistance);
-                                int event_ID = probecarrier->carrier_ID*graph->max_pair_degree+jump;
-                                
-                                double fromlongrange;
-                                double tolongrange;
-                                if(globevent->device) {
-                                    fromlongrange = longrange->Get_cached_longrange(probenode->layer_index);
-                                    if(probenode->pairing_nodes[jump]->node_type == Normal) {
-                                        tolongrange = longrange->Get_cached_longrange(probenode->pairing_nodes[jump]->layer_index);
-                                    }
-                                    else { // collection
-                                        tolongrange = 0.0;
-                                    }
-                                }
-                                else {
-                                    fromlongrange = 0.0;
-                                    tolongrange = 0.0;
-                                }
-                                
-                                if(distsqr <= globevent->coulcut*globevent->coulcut) {
-                                    if(probecarrier->carrier_type==Electron) {
-                                        probecarrier->srto[jump] += 
-                                                        interact_sign*Compute_Coulomb_potential(carpos.x(),jumpdistance,
-                                                        graph->sim_box_size, globevent);
-                                        
-                                        El_non_injection_events[event_ID]->Set_non_injection_event(graph->nodes, probecarrier, jump, fromlongrange, tolongrange, globevent);
-                                        El_non_injection_rates->setrate(event_ID, El_non_injection_events[event_ID]->rate);
-                                        el_dirty = true;
-                                    }
-                                    else if(probecarrier->carrier_type==Hole) {
-                                        probecarrier->srto[jump] += 
-                                                            interact_sign*Compute_Coulomb_potential(carpos.x(),jumpdistance,
-                                                            graph->sim_box_size, globevent);
-                                        Ho_non_injection_events[event_ID]->Set_non_injection_event(graph->nodes, probecarrier, jump, fromlongrange, tolongrange, globevent);
-                                        Ho_non_injection_rates->setrate(event_ID, Ho_non_injection_events[event_ID]->rate);
-                                        ho_dirty = true;                                        
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }   
-    }  
-
-    // update event rates for carrier 1 , done after all carriers within radius coulcut are checked
-    for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
-        int event_ID = carrier->carrier_ID*graph->max_pair_degree+jump;
     
-        double fromlongrange;
-        double tolongrange;
-        if(globevent->device) {
-            fromlongrange = longrange->Get_cached_longrange(carnode->layer_index);
-            if(carnode->pairing_nodes[jump]->node_type == Normal) {
-                tolongrange = longrange->Get_cached_longrange(carnode->pairing_nodes[jump]->layer_index);
+    int nrjumps = carnode->pairing_nodes.size();
+    for (long ifound = 0; ifound < nrfound; ifound++) {
+        if(neighbour_state[ifound] == Not_neighbour) continue; // the moving carrier itself
+        if(AR == Add) {
+            carrier->srfrom += neighbour_srfrom[ifound];
+            for (int jump=0; jump < nrjumps; jump++) {
+                carrier->srto[jump] += neighbour_srto[ifound*graph->max_pair_degree+jump];
             }
-            else { // collection
-                tolongrange = 0.0;
+        }
+        else if(AR == Remove) {
+            // Reset Coulomb potential for carrier1 and its neighbours
+            carrier->srfrom = 0.0;
+            for (int jump=0; jump < nrjumps; jump++) {
+                carrier->srto[jump] = 0.0;
             }
         }
-        else {
-            fromlongrange = 0.0;
-            tolongrange = 0.0;
+        if(neighbour_state[ifound] == Touched_neighbour) {
+            int icartype = mesh.found_type[ifound];
+            Touch_carrier((icartype == 0) ? state->electrons[mesh.found_ID[ifound]] : state->holes[mesh.found_ID[ifound]], Touched);
         }
-        
-        if(carrier->carrier_type==Electron) {
-            if(AR == Add) {
-                El_non_injection_events[event_ID]->Set_non_injection_event(graph->nodes, carrier, jump, fromlongrange, tolongrange, globevent);
-                El_non_injection_rates->setrate(event_ID, El_non_injection_events[event_ID]->rate);
-                el_dirty = true;
-            }
-            else {
-                El_non_injection_events[event_ID]->fromtype = Fromnotinbox;
-                El_non_injection_events[event_ID]->totype = Tonotinbox;
-                El_non_injection_events[event_ID]->rate = 0.0;
-                El_non_injection_rates->setrate(event_ID, 0.0);
-                el_dirty = true;
+    }
+
+    // update event rates for carrier 1 at the end of the step, removed carriers have no events left
+    if(AR == Add) {
+        Touch_carrier(carrier, Touched);
+    }
+    else {
+        Touch_carrier(carrier, Removed);
+    }
+}
+
+void Events::Neighbour_task::Run_part(int part, int nrparts) {
+    long first = part*nrfound/nrparts;
+    long last = (part+1)*nrfound/nrparts;
+    for (long ifound = first; ifound < last; ifound++) {
+        events->Effect_neighbour(ifound, AR, carrier, interact_sign, graph, state, globevent);
+    }
+}
+
+void Events::Effect_neighbour(long ifound, action AR, Carrier* carrier, int interact_sign, Graph* graph, State* state,
+                                                   Globaleventinfo* globevent) {
+    
+    // Writes only to the found carrier and to slot ifound of the neighbour_* buffers
+    Cellmesh &mesh = state->coulomb_mesh;
+    double RCSQR = globevent->coulcut*globevent->coulcut;
+    Node* carnode = graph->nodes[carrier->carrier_node_ID];
+    myvec carpos = carnode->node_position;
+    double* srto_contribution = &neighbour_srto[ifound*graph->max_pair_degree];
+    
+    neighbour_srfrom[ifound] = 0.0;
+    for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
+        srto_contribution[jump] = 0.0;
+    }
+    neighbour_state[ifound] = Not_neighbour;
+    
+    int icartype = mesh.found_type[ifound];
+    int probecarrier_ID = mesh.found_ID[ifound];
+    if (probecarrier_ID == carrier->carrier_ID && icartype == (carrier->carrier_type == Electron ? 0 : 1)) return;
+    
+    Carrier* probecarrier = (icartype == 0) ? state->electrons[probecarrier_ID] : state->holes[probecarrier_ID];
+    Node* probenode = graph->nodes[probecarrier->carrier_node_ID];
+    int probecharge;
+    if(icartype == 0) {
+        probecharge = -1;
+    }
+    else {
+        probecharge = 1;
+    }
+      
+    int pair_sign = interact_sign*probecharge;
+      
+    myvec np_probepos = myvec(mesh.found_x[ifound], mesh.found_y[ifound], mesh.found_z[ifound]);
+    myvec distance = np_probepos-carpos;
+
+    double distancesqr = distance.x()*distance.x() + distance.y()*distance.y() + distance.z()*distance.z();
+
+    bool probe_touched = false;
+    if((carnode->node_ID!=probenode->node_ID)&&(distancesqr<=RCSQR)) { 
+                        
+        // Charge interacting with its own images, taken care off in graph.h
+        // In case multiple charges are on the same node, coulomb calculation on the same spot is catched
+                  
+        //First we take the direction sr interactions into account
+        if (AR==Add) neighbour_srfrom[ifound] = pair_sign*Coulomb_potential(probenode,carnode,np_probepos.x(),-1.0*distance,
+                                    graph->sim_box_size,globevent);
+        probecarrier->srfrom += pair_sign*Coulomb_potential(carnode,probenode,carpos.x(),distance,
+                                    graph->sim_box_size,globevent);
+        probe_touched = true;
+    }
+    if (AR==Add) {
+      
+        // Adjust Coulomb potential for neighbours of the added carrier
+        for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
+            myvec jumpdistancevector = carnode->static_event_info[jump].distance;
+            myvec jumpcarrierpos = carnode->node_position + jumpdistancevector;
+            myvec jumpdistance = np_probepos - jumpcarrierpos;
+            double distancejumpsqr = jumpdistance.x()*jumpdistance.x() + jumpdistance.y()*jumpdistance.y() + jumpdistance.z()*jumpdistance.z();
+
+            if((carnode->pairing_nodes[jump] != probenode)&&(distancejumpsqr <= RCSQR)) {
+                            
+                srto_contribution[jump] = pair_sign*Coulomb_potential(probenode,carnode->pairing_nodes[jump],np_probepos.x(),-1.0*jumpdistance,
+                                 graph->sim_box_size, globevent);
             }
         }
-        else if(carrier->carrier_type==Hole) {
-            if(AR == Add) {
-                Ho_non_injection_events[event_ID]->Set_non_injection_event(graph->nodes, carrier, jump, fromlongrange, tolongrange, globevent);
-                Ho_non_injection_rates->setrate(event_ID, Ho_non_injection_events[event_ID]->rate);
-                ho_dirty = true;
-            }
-            else {
-                Ho_non_injection_events[event_ID]->fromtype = Fromnotinbox;
-                Ho_non_injection_events[event_ID]->totype = Tonotinbox;
-                Ho_non_injection_events[event_ID]->rate = 0.0;
-                Ho_non_injection_rates->setrate(event_ID, 0.0);
-                ho_dirty = true;
-            }            
+    }
+   
+    // Adjust Coulomb potential for neighbours of carrier2, its rates are recomputed at the end of the step
+    for (unsigned int jump=0; jump < probenode->pairing_nodes.size(); jump++) {
+        myvec jumpdistancevector = probenode->static_event_info[jump].distance;
+        myvec jumpprobepos = np_probepos+jumpdistancevector;
+        myvec jumpdistance = carpos-jumpprobepos;
+        double distsqr = jumpdistance.x()*jumpdistance.x() + jumpdistance.y()*jumpdistance.y() + jumpdistance.z()*jumpdistance.z();
+                        
+        if((probenode->pairing_nodes[jump] != carnode)&&(distsqr <= RCSQR)) {
+            probecarrier->srto[jump] += 
+                            pair_sign*Coulomb_potential(carnode,probenode->pairing_nodes[jump],carpos.x(),-1.0*jumpdistance,
+                            graph->sim_box_size, globevent);
+            probe_touched = true;
+        }
+    }
+    neighbour_state[ifound] = probe_touched ? Touched_neighbour : Neighbour;
+}
+
+void Events::Initialize_neighbour_team(Graph* graph, Globaleventinfo* globevent, int nthreads) {
+    // Every carrier has to be found at most once (owned by one member), so every periodic box length has to exceed
+    // twice the Gather cutoff
+    double cutoff = globevent->coulcut + graph->hopdist;
+    myvec box = graph->sim_box_size;
+    if ((!globevent->device && box.x() <= 2.0*cutoff) || box.y() <= 2.0*cutoff || box.z() <= 2.0*cutoff) { nthreads = 1; }
+    neighbour_team.Start(nthreads);
+}
+
+void Events::Set_carrier_non_injection_events(Carrier* carrier, Graph* graph, Globaleventinfo* globevent) {
+    if(carrier->carrier_type == Electron) {
+        Set_carrier_non_injection_events(carrier, graph, globevent, jump_tolongrange, jump_rates, El_non_injection_batch);
+        el_dirty = true;
+    }
+    else if(carrier->carrier_type == Hole) {
+        Set_carrier_non_injection_events(carrier, graph, globevent, jump_tolongrange, jump_rates, Ho_non_injection_batch);
+        ho_dirty = true;
+    }
+}
+
+void Events::Set_carrier_non_injection_events(Carrier* carrier, Graph* graph, Globaleventinfo* globevent,
+                                              vector<double> &tolongrange, vector<double> &rates, Ratebatch &batch) {
+    // Only reads shared data and writes the carrier's own events, so carriers can be handled concurrently
+    Node* carnode = graph->nodes[carrier->carrier_node_ID];
+    int nrjumps = carnode->pairing_nodes.size();
+    int first_event_ID = carrier->carrier_ID*graph->max_pair_degree;
+    Eventtable &events = (carrier->carrier_type == Electron) ? El_non_injection_events : Ho_non_injection_events;
+    
+    double fromlongrange = 0.0;
+    tolongrange.assign(nrjumps, 0.0);
+    rates.resize(nrjumps);
+    if(globevent->device && carrier->is_in_sim_box) {
+        fromlongrange = longrange->Get_cached_longrange(carnode->layer_index);
+        for (int jump=0; jump < nrjumps; jump++) {
+            if(carnode->pairing_nodes[jump]->node_type == Normal) {
+                tolongrange[jump] = longrange->Get_cached_longrange(carnode->pairing_nodes[jump]->layer_index);
+            } // collection: 0
         }
     }
-}        
+    
+    Event::Set_non_injection_events(events, first_event_ID, graph->nodes, carrier, fromlongrange, &tolongrange[0], &rates[0], globevent);
+    for (int jump=0; jump < nrjumps; jump++) {
+        batch.Add(first_event_ID+jump, rates[jump]);
+    }
+}
+
+void Events::Set_injection_event_rate(CarrierType carrier_type, int event_ID, Graph* graph, Globaleventinfo* globevent, Ratebatch &batch) {
+    Eventtable &events = (carrier_type == Electron) ? El_injection_events : Ho_injection_events;
+    Node* electrode = (events.electrode[event_ID] == 0) ? graph->left_electrode : graph->right_electrode;
+    int injector_ID = events.jump[event_ID];
+    Node* injectnode = electrode->pairing_nodes[injector_ID];
+    double tolongrange;
+    if(injectnode->node_type == Normal){
+        tolongrange = longrange->Get_cached_longrange(injectnode->layer_index);
+    }
+    else { // collection (in this case injection to collection)
+        tolongrange = 0.0;
+    }
+    batch.Add(event_ID, Event::Set_injection_event(events, event_ID, electrode, injector_ID, carrier_type, 0.0, tolongrange, globevent));
+}
+
+void Events::Initialize_active_carriers(State* state) {
+    el_active.clear();
+    ho_active.clear();
+    el_active_index.assign(state->electrons.size(), -1);
+    ho_active_index.assign(state->holes.size(), -1);
+    for (unsigned int electron_ID = 0; electron_ID < state->electrons.size(); electron_ID++) {
+        if(state->electrons[electron_ID]->is_in_sim_box) Activate_carrier(state->electrons[electron_ID]);
+    }
+    for (unsigned int hole_ID = 0; hole_ID < state->holes.size(); hole_ID++) {
+        if(state->holes[hole_ID]->is_in_sim_box) Activate_carrier(state->holes[hole_ID]);
+    }
+}
+
+void Events::Activate_carrier(Carrier* carrier) {
+    vector<Carrier*> &active = (carrier->carrier_type == Electron) ? el_active : ho_active;
+    vector<int> &active_index = (carrier->carrier_type == Electron) ? el_active_index : ho_active_index;
+    if((int) active_index.size() <= carrier->carrier_ID) {
+        active_index.resize(carrier->carrier_ID+1, -1);
+    }
+    if(active_index[carrier->carrier_ID] >= 0) return;
+    active_index[carrier->carrier_ID] = active.size();
+    active.push_back(carrier);
+}
+
+void Events::Deactivate_carrier(Carrier* carrier) {
+    // swap with the last active carrier, so the list stays dense
+    vector<Carrier*> &active = (carrier->carrier_type == Electron) ? el_active : ho_active;
+    vector<int> &active_index = (carrier->carrier_type == Electron) ? el_active_index : ho_active_index;
+    if((int) active_index.size() <= carrier->carrier_ID || active_index[carrier->carrier_ID] < 0) return;
+    int position = active_index[carrier->carrier_ID];
+    Carrier* last = active.back();
+    active[position] = last;
+    active_index[last->carrier_ID] = position;
+    active.pop_back();
+    active_index[carrier->carrier_ID] = -1;
+}
         
-void Events::Effect_injection_rates(action AR, Graph* graph, Carrier* carrier, 
-                                                   double dist_to_electrode, Node* electrode, 
-                                                   Globaleventinfo* globevent) {
+void Events::Effect_injection_rates(action AR, Graph* graph, Carrier* carrier, Node* electrode, Globaleventinfo* globevent) {
                                                    
     int interact_sign;
-    int x_mesh;
     
     if(AR == Add) {interact_sign = 1;}
     if(AR == Remove) {interact_sign = -1;}
     if(carrier->carrier_type == Electron) {interact_sign *= -1;}
     if(carrier->carrier_type == Hole) {interact_sign *= 1;}
-    if(electrode->node_type == LeftElectrode) {x_mesh = 0;}
-    if(electrode->node_type == RightElectrode) {x_mesh = graph->nodemeshsizeX-1;}
     
-    Node* carnode = graph->nodes[carrier->carrier_node_ID];
-    myvec carpos = carnode->node_position;
-  
-    double bound = sqrt(double(globevent->coulcut*globevent->coulcut - dist_to_electrode*dist_to_electrode));
+    // calculated for holes, multiply interact_sign with -1 for electrons
+    Injectiontable &table = (electrode->node_type == LeftElectrode) ? left_injection_table : right_injection_table;
+    long last = table.Last(carrier->carrier_node_ID);
+    for (long entry = table.First(carrier->carrier_node_ID); entry < last; entry++) {
+        int injector_ID = table.injector[entry];
+        electrode->pairing_nodes[injector_ID]->injection_potential += interact_sign*table.potential[entry];
+        Touch_injector(graph, injector_ID, electrode, globevent);
+    }
+}
 
-    // Define cubic boundaries in non-periodic coordinates
-    double iy1 = carpos.y()-bound-graph->hopdist; double iy2 = carpos.y()+bound+graph->hopdist;
-    double iz1 = carpos.z()-bound-graph->hopdist; double iz2 = carpos.z()+bound+graph->hopdist;
+void Events::Touch_injector(Graph* graph, int injector_ID, Node* electrode, Globaleventinfo* globevent) {
+    // Injection events of the left electrode come first in the event lists
+    int event_ID;
+    if(electrode->node_type == LeftElectrode) {
+        event_ID = injector_ID;
+        if(globevent->left_injection[1]) Touch_injection_event(Hole, event_ID);
+        if(globevent->left_injection[0]) Touch_injection_event(Electron, event_ID);
+    }
+    else if(electrode->node_type == RightElectrode) {
+        if(globevent->right_injection[1]) {
+            event_ID = injector_ID;
+            if(globevent->left_injection[1]) event_ID += graph->nr_left_injector_nodes;
+            Touch_injection_event(Hole, event_ID);
+        }                               
+        if(globevent->right_injection[0]) {
+            event_ID = injector_ID;
+            if(globevent->left_injection[0]) event_ID += graph->nr_left_injector_nodes;
+            Touch_injection_event(Electron, event_ID);
+        }
+    }
+}
 
-    // Translate cubic boundaries to sublattice boundaries in non-periodic coordinates
-    int sy1 = floor(iy1/graph->hopdist);
-    int sy2 = floor(iy2/graph->hopdist);
-    int sz1 = floor(iz1/graph->hopdist);
-    int sz2 = floor(iz2/graph->hopdist);
-  
-    // Now visit all relevant sublattices
-    for (int isz=sz1; isz<=sz2; isz++) {
-        int r_isz = isz;
-        while (r_isz < 0) r_isz += graph->nodemeshsizeZ;
-        while (r_isz >= graph->nodemeshsizeZ) r_isz -= graph->nodemeshsizeZ;
-        for (int isy=sy1; isy<=sy2; isy++) {
-            int r_isy = isy;
-            while (r_isy < 0) r_isy += graph->nodemeshsizeY;
-            while (r_isy >= graph->nodemeshsizeY) r_isy -= graph->nodemeshsizeY;
-       
-            // Ask a list of all nodes in this sublattice
-            list<Node*>::iterator li1,li2,li3;
-            list<Node*> *nodemesh = &graph->node_mesh[x_mesh][r_isy][r_isz];
-            li1 = nodemesh->begin();
-            li2 = nodemesh->end();
-            for (li3=li1; li3!=li2; li3++) {
-                Node* probenode = *li3;
-                myvec probepos = probenode->node_position;
-          
-                // Compute coordinates in non-periodic lattice
-          
-                myvec periodic_convert = myvec(0.0,(isy-r_isy)*graph->hopdist,(isz-r_isz)*graph->hopdist);
-                myvec np_probepos = probepos + periodic_convert;
-                myvec distance = np_probepos-carpos;
-
-                double distancesqr = abs(distance)*abs(distance);
-
-                if ((probenode->node_ID!=carnode->node_ID)&&(distancesqr <= globevent->coulcut*globevent->coulcut)) { // calculated for holes, multiply interact_sign with -1 for electrons
-                    probenode->injection_potential +=interact_sign*Compute_Coulomb_potential(carpos.x(),distance,graph->sim_box_size,globevent);
-                    int event_ID;
-                    int injector_ID;
-                    double tolongrange;
-                        
-                    if(probenode->node_type == Normal){
-                        tolongrange = longrange->Get_cached_longrange(probenode->layer_index);
-                    }
-                    else { // collection (in this case injection to collection)
-                        tolongrange = 0.0;
-                    }
-                        
-                    if(electrode->node_type == LeftElectrode) {
-                        injector_ID = probenode->left_injector_ID;
-                        event_ID = injector_ID;
-                        if(globevent->left_injection[1]){
-                            Ho_injection_events[event_ID]->Set_injection_event(electrode, injector_ID, 
-                                                  Hole, 0.0, tolongrange, globevent);
-                            Ho_injection_rates->setrate(event_ID, Ho_injection_events[event_ID]->rate);
-                            ho_dirty = true;
-                        }
-                        if(globevent->left_injection[0]) {
-                            El_injection_events[event_ID]->Set_injection_event(electrode, injector_ID, 
-                                                  Electron, 0.0, tolongrange, globevent);
-                            El_injection_rates->setrate(event_ID, El_injection_events[event_ID]->rate);
-                            el_dirty = true;
-                        }
-                    }
-                    else if(electrode->node_type == RightElectrode) {
-                        injector_ID = probenode->right_injector_ID;
-                        if(globevent->right_injection[1]) {
-                            event_ID = injector_ID;
-                            if(globevent->left_injection[1]) event_ID += graph->nr_left_injector_nodes;
-                            Ho_injection_events[event_ID]->Set_injection_event(electrode, injector_ID, 
-                                                  Hole, 0.0, tolongrange, globevent);
-                            Ho_injection_rates->setrate(event_ID, Ho_injection_events[event_ID]->rate);
-                            ho_dirty = true;
-                        }                               
-                        if(globevent->right_injection[0]) {
-                            event_ID = injector_ID;
-                            if(globevent->left_injection[0]) event_ID += graph->nr_left_injector_nodes;
-                            El_injection_events[event_ID]->Set_injection_event(electrode, injector_ID, 
-                                                  Electron, 0.0, tolongrange, globevent);
-                            El_injection_rates->setrate(event_ID, El_injection_events[event_ID]->rate);
-                            el_dirty = true;
-                        }
-                    }
+void Events::Recompute_injection_potentials(Graph* graph, Globaleventinfo* globevent) {
+    
+    // Sum from scratch over the carriers next to the electrodes, so round-off of the incremental updates does not pile up
+    for (int side = 0; side < 2; side++) {
+        Node* electrode = (side == 0) ? graph->left_electrode : graph->right_electrode;
+        for (unsigned int injector_ID = 0; injector_ID < electrode->pairing_nodes.size(); injector_ID++) {
+            electrode->pairing_nodes[injector_ID]->injection_potential = 0.0;
+        }
+    }
+    for (int side = 0; side < 2; side++) {
+        Node* electrode = (side == 0) ? graph->left_electrode : graph->right_electrode;
+        Injectiontable &table = (side == 0) ? left_injection_table : right_injection_table;
+        for (int type = 0; type < 2; type++) {
+            vector<Carrier*> &active = (type == 0) ? el_active : ho_active;
+            double charge = (type == 0) ? -1.0 : 1.0;
+            for (unsigned int i = 0; i < active.size(); i++) {
+                long last = table.Last(active[i]->carrier_node_ID);
+                for (long entry = table.First(active[i]->carrier_node_ID); entry < last; entry++) {
+                    electrode->pairing_nodes[table.injector[entry]]->injection_potential += charge*table.potential[entry];
                 }
             }
         }
-    }  
+    }
 }
 
-double Events::Compute_Coulomb_potential(double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent) {
+void Events::Touch_carrier(Carrier* carrier, Touch_state touch) {
+    // the last touch wins: a carrier that is removed and added again in one step (a transfer) is recomputed
+    vector<char> &touched = (carrier->carrier_type == Electron) ? el_touched : ho_touched;
+    vector<int> &touched_IDs = (carrier->carrier_type == Electron) ? el_touched_IDs : ho_touched_IDs;
+    if((int) touched.size() <= carrier->carrier_ID) {
+        touched.resize(carrier->carrier_ID+1, Untouched);
+    }
+    if(touched[carrier->carrier_ID] == Untouched) {
+        touched_IDs.push_back(carrier->carrier_ID);
+    }
+    touched[carrier->carrier_ID] = touch;
+}
 
-    double coulpot;
-    double RC = globevent->coulcut;
-    double RCSQR = RC*RC;
-   
-    if(!globevent->device) {
-        coulpot = 1.0/abs(dif)-1.0/RC;
+void Events::Touch_injection_event(CarrierType carrier_type, int event_ID) {
+    vector<char> &touched = (carrier_type == Electron) ? el_injection_touched : ho_injection_touched;
+    vector<int> &touched_IDs = (carrier_type == Electron) ? el_injection_touched_IDs : ho_injection_touched_IDs;
+    if((int) touched.size() <= event_ID) {
+        touched.resize(event_ID+1, Untouched);
     }
-    else {
-        coulpot = 1.0/abs(dif)-1.0/RC; // self image potential is taken into account elsewhere
+    if(touched[event_ID] == Untouched) {
+        touched_IDs.push_back(event_ID);
+        touched[event_ID] = Touched;
+    }
+}
+
+void Events::Refresh_touched_events(Graph* graph, State* state, Globaleventinfo* globevent) {
+    
+    for (int type = 0; type < 2; type++) {
+        vector<Carrier*> &carriers = (type == 0) ? state->electrons : state->holes;
+        Eventtable &events = (type == 0) ? El_non_injection_events : Ho_non_injection_events;
+        Ratebatch &batch = (type == 0) ? El_non_injection_batch : Ho_non_injection_batch;
+        vector<char> &touched = (type == 0) ? el_touched : ho_touched;
+        vector<int> &touched_IDs = (type == 0) ? el_touched_IDs : ho_touched_IDs;
         
-        double L = sim_box_size.x();
-        double distsqr_planar = dif.y()*dif.y() + dif.z()*dif.z();
-        //double distsqr = dif.x()*dif.x() + distsqr_planar;
-      
-        int sign;
-        double distx_1;
-        double distx_2;
-        double distancesqr_1;
-        double distancesqr_2;
-        bool outside_cut_off1 = false;
-        bool outside_cut_off2 = false;
-      
-        while(!(outside_cut_off1&&outside_cut_off2)) {
-            for (int i=0;i<globevent->nr_sr_images; i++) {
-                if (div(i,2).rem==0) { // even generation
-                    sign = -1;
-                    distx_1 = i*L + 2*startx + dif.x();
-                    distx_2 = (i+2)*L - 2*startx - dif.x(); 
-                }
-                else {
-                    sign = 1;
-                    distx_1 = (i+1)*L + dif.x();
-                    distx_2 = (i+1)*L - dif.x();
-                }
-                distancesqr_1 = distx_1*distx_1 + distsqr_planar;
-                if (distancesqr_1<=RCSQR) {
-                    coulpot += sign*1.0/sqrt(distancesqr_1)-1.0/(RC);
-                }
-                else {
-                    outside_cut_off1 = true;
-                }
-                distancesqr_2 = distx_2*distx_2 + distsqr_planar;
-                if (distancesqr_2<=RCSQR) {
-                    coulpot += sign*1.0/sqrt(distancesqr_2)-1.0/(RC);
-                }
-                else {
-                    outside_cut_off2 = true;
+        for (unsigned int i = 0; i < touched_IDs.size(); i++) {
+            int carrier_ID = touched_IDs[i];
+            Carrier* carrier = carriers[carrier_ID];
+            if(touched[carrier_ID] == Touched) {
+                Set_carrier_non_injection_events(carrier, graph, globevent);
+            }
+            else {
+                Node* carnode = graph->nodes[carrier->carrier_node_ID];
+                for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
+                    int event_ID = carrier_ID*graph->max_pair_degree+jump;
+                    events.Set_kind(event_ID, Notinbox);
+                    batch.Add(event_ID, 0.0);
                 }
+                if(type == 0) {el_dirty = true;} else {ho_dirty = true;}
             }
+            touched[carrier_ID] = Untouched;
         }
+        touched_IDs.clear();
+    }
+    
+    for (int type = 0; type < 2; type++) {
+        Ratebatch &batch = (type == 0) ? El_injection_batch : Ho_injection_batch;
+        vector<char> &touched = (type == 0) ? el_injection_touched : ho_injection_touched;
+        vector<int> &touched_IDs = (type == 0) ? el_injection_touched_IDs : ho_injection_touched_IDs;
+        CarrierType carrier_type = (type == 0) ? Electron : Hole;
+        
+        for (unsigned int i = 0; i < touched_IDs.size(); i++) {
+            int event_ID = touched_IDs[i];
+            Set_injection_event_rate(carrier_type, event_ID, graph, globevent, batch);
+            if(type == 0) {el_dirty = true;} else {ho_dirty = true;}
+            touched[event_ID] = Untouched;
+        }
+        touched_IDs.clear();
+    }
+}
+
+double Events::Compute_Coulomb_potential(double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent) {
+    return Coulombtable::Compute_potential(startx, dif, sim_box_size, globevent);
+}
+
+double Events::Coulomb_potential(Node* source, Node* target, double startx, myvec dif, myvec sim_box_size, Globaleventinfo* globevent) {
+    // Table lookup when both are nodes within coulcut of each other, the image series otherwise
+    double coulpot;
+    if (source->node_type == Normal && target->node_type == Normal && coulomb_table.Lookup(source->node_ID, target->node_ID, coulpot)) {
+        return coulpot;
     }
-    return coulpot;
+    return Compute_Coulomb_potential(startx, dif, sim_box_size, globevent);
 }
 
 
 void Events::Recompute_all_non_injection_events(Graph* graph, State* state, Globaleventinfo* globevent) {
+    // carriers outside the box have no events, only the active carriers are visited.
+    // Pending updates go first, so the fresh rates of the sweep are the ones that end up in the trees
+    Flush_rate_batches();
+    Run_recompute_workers(graph, state, globevent, Carrier_rates);
+}
+
+void Events::Recompute_all_injection_events(Graph* graph, Globaleventinfo* globevent) {
+    Flush_rate_batches();
+    if(globevent->device) Recompute_injection_potentials(graph, globevent);
+    Run_recompute_workers(graph, NULL, globevent, Injection_rates);
+}
+
+void Events::Run_recompute_workers(Graph* graph, State* state, Globaleventinfo* globevent, Sweep sweep) {
     
-    int Event_map;
-       
-    for (unsigned int electron_ID = 0; electron_ID<state->electrons.size(); electron_ID++) {
-        Node* electron_node = graph->nodes[state->electrons[electron_ID]->carrier_node_ID];
-        for (unsigned int ipair = 0; ipair < electron_node->pairing_nodes.size();ipair++){
-            
-            Event_map = electron_ID*graph->max_pair_degree + ipair;
-            Carrier* electron = state->electrons[electron_ID];
-            
-            double lrfrom;
-            double lrto;
-            
-            if(globevent->device && electron->is_in_sim_box){
-                lrfrom = longrange->Get_cached_longrange(electron_node->layer_index);
-                if(electron_node->pairing_nodes[ipair]->node_type == Normal) {
-                    lrto = longrange->Get_cached_longrange(electron_node->pairing_nodes[ipair]->layer_index);
-                }
-                else { // Collection
-                    lrto = 0.0;
-                }
+    // Jobs are the electrons followed by the holes (carriers or injection events), in contiguous ranges per worker
+    long nrjobs = (sweep == Injection_rates) ? El_injection_events.Size() + Ho_injection_events.Size() : el_active.size() + ho_active.size();
+    if(nrjobs == 0) return;
+    
+    // Starting threads costs about as much as a few hundred carriers, small sweeps stay on this thread
+    const long min_jobs_per_worker = 256;
+    long nrworkers = nthreads;
+    if(nrjobs < nrworkers*min_jobs_per_worker) nrworkers = nrjobs/min_jobs_per_worker;
+    if(nrworkers < 1) nrworkers = 1;
+    
+    vector<Recompute_worker*> workers;
+    for (long id = 0; id < nrworkers; id++) {
+        workers.push_back(new Recompute_worker(this, graph, state, globevent, sweep, id*nrjobs/nrworkers, (id+1)*nrjobs/nrworkers));
+    }
+    if(nrworkers == 1) {
+        workers[0]->Run();
+    }
+    else {
+        for (long id = 0; id < nrworkers; id++) { workers[id]->Start(); }
+        for (long id = 0; id < nrworkers; id++) { workers[id]->WaitDone(); }
+    }
+    
+    for (long id = 0; id < nrworkers; id++) {
+        if(sweep == Injection_rates) {
+            workers[id]->el_batch.Flush(El_injection_rates);
+            workers[id]->ho_batch.Flush(Ho_injection_rates);
+        }
+        else {
+            workers[id]->el_batch.Flush(El_non_injection_rates);
+            workers[id]->ho_batch.Flush(Ho_non_injection_rates);
+        }
+        delete workers[id];
+    }
+    el_dirty = true;
+    ho_dirty = true;
+}
+
+void Events::Recompute_worker::Run(void) {
+    
+    if(sweep == Injection_rates) {
+        long nr_el_events = events->El_injection_events.Size();
+        for (long job = first_job; job < last_job; job++) {
+            if(job < nr_el_events) {
+                events->Set_injection_event_rate(Electron, job, graph, globevent, el_batch);
             }
             else {
-                lrfrom = 0.0;
-                lrto = 0.0;
+                events->Set_injection_event_rate(Hole, job - nr_el_events, graph, globevent, ho_batch);
             }
-            
-            El_non_injection_events[Event_map]->Set_non_injection_event(graph->nodes,electron, ipair, lrfrom,lrto, globevent);
-            El_non_injection_rates->setrate(Event_map,El_non_injection_events[Event_map]->rate);
-            el_dirty = true;
-        }
-    }
-
-    for (unsigned int hole_ID = 0; hole_ID<state->holes.size(); hole_ID++) {
-        Node* hole_node = graph->nodes[state->holes[hole_ID]->carrier_node_ID];
-        for (unsigned int ipair = 0; ipair < hole_node->pairing_nodes.size();ipair++){
-            
-            Event_map = hole_ID*graph->max_pair_degree + ipair;
-            Carrier* hole = state->holes[hole_ID];
-            
-            double lrfrom;
-            double lrto;
-            
-            if(globevent->device && hole->is_in_sim_box){
-                lrfrom = longrange->Get_cached_longrange(hole_node->layer_index);
-                if(hole_node->pairing_nodes[ipair]->node_type == Normal) {
-                    lrto = longrange->Get_cached_longrange(hole_node->pairing_nodes[ipair]->layer_index);
-                }
-                else { // Collection
-                    lrto = 0.0;
-                }
+        }
+    }
+    else if(sweep == Carrier_rates) {
+        long nr_el_active = events->el_active.size();
+        for (long job = first_job; job < last_job; job++) {
+            if(job < nr_el_active) {
+                events->Set_carrier_non_injection_events(events->el_active[job], graph, globevent, tolongrange, rates, el_batch);
             }
             else {
-                lrfrom = 0.0;
-                lrto = 0.0;
+                events->Set_carrier_non_injection_events(events->ho_active[job - nr_el_active], graph, globevent, tolongrange, rates, ho_batch);
             }
-            
-            Ho_non_injection_events[Event_map]->Set_non_injection_event(graph->nodes,hole, ipair, lrfrom ,lrto, globevent);
-            Ho_non_injection_rates->setrate(Event_map,Ho_non_injection_events[Event_map]->rate);
-            ho_dirty = true;
+        }
+    }
+    else if(sweep == Carrier_potentials) {
+        long nr_el_active = events->el_active.size();
+        for (long job = first_job; job < last_job; job++) {
+            Carrier* carrier = (job < nr_el_active) ? events->el_active[job] : events->ho_active[job - nr_el_active];
+            events->Compute_carrier_potentials(carrier, mesh, graph, state, globevent);
         }
     }
 }
 
-void Events::Recompute_all_injection_events(Graph* graph, Globaleventinfo* globevent) {
+void Events::Initialize_carriers(Graph* graph, State* state, Globaleventinfo* globevent) {
     
-    int Event_map;
-
-    for (unsigned int inject_node = 0; inject_node<graph->left_electrode->pairing_nodes.size(); inject_node++) {
-
-        Event_map = inject_node;
-
-        double lrto;
-        if(graph->left_electrode->pairing_nodes[inject_node]->node_type == Normal) {
-            lrto = longrange->Get_cached_longrange(graph->left_electrode->pairing_nodes[inject_node]->layer_index);
+    // Sets up everything that depends on the carriers already in the box (a loaded state or a starting density) in one go,
+    // instead of adding them one by one. The carriers have to be on their nodes and in the coulomb mesh.
+    nelectrons = el_active.size();
+    nholes = ho_active.size();
+    ncarriers = nelectrons + nholes;
+    
+    for (int type = 0; type < 2; type++) {
+        vector<Carrier*> &active = (type == 0) ? el_active : ho_active;
+        Ratetree* rates = (type == 0) ? El_non_injection_rates : Ho_non_injection_rates;
+        for (unsigned int i = 0; i < active.size(); i++) {
+            rates->set_cell(active[i]->carrier_ID, state->Coulomb_mesh_cell(graph, active[i], globevent));
         }
-        else { // Collection
-            lrto = 0.0;
+    }
+    
+    if(globevent->device) {
+        longrange->Reset();
+        for (unsigned int i = 0; i < el_active.size(); i++) {
+            longrange->layercharge[graph->nodes[el_active[i]->carrier_node_ID]->layer_index] -= 1.0;
         }
-        if(globevent->left_injection[0]){
-            El_injection_events[Event_map]->Set_injection_event(graph->left_electrode, inject_node, Electron, 0.0, lrto, globevent);   
-            El_injection_rates->setrate(Event_map,El_injection_events[Event_map]->rate);
-            el_dirty = true;
+        for (unsigned int i = 0; i < ho_active.size(); i++) {
+            longrange->layercharge[graph->nodes[ho_active[i]->carrier_node_ID]->layer_index] += 1.0;
         }
-        if(globevent->left_injection[1]) {
-            Ho_injection_events[Event_map]->Set_injection_event(graph->left_electrode, inject_node, Hole, 0.0, lrto, globevent);   
-            Ho_injection_rates->setrate(Event_map,Ho_injection_events[Event_map]->rate);
-            ho_dirty = true;
-        }        
+        longrange->Update_cache(graph->sim_box_size, globevent);
     }
     
-    for (unsigned int inject_node = 0; inject_node<graph->right_electrode->pairing_nodes.size(); inject_node++) {
+    // Every carrier gathers its own neighbours, so the carriers can be split over the workers without sharing writes
+    Run_recompute_workers(graph, state, globevent, Carrier_potentials);
+    
+    // Injection potentials are summed from scratch there, the trees are filled through the bulk setrates path
+    Recompute_all_injection_events(graph, globevent);
+    Recompute_all_non_injection_events(graph, state, globevent);
+}
 
-        double lrto;
-        if(graph->right_electrode->pairing_nodes[inject_node]->node_type == Normal) {
-            lrto = longrange->Get_cached_longrange(graph->right_electrode->pairing_nodes[inject_node]->layer_index);
-        }
-        else { // Collection
-            lrto = 0.0;
-        }        
+void Events::Compute_carrier_potentials(Carrier* carrier, Cellmesh &mesh, Graph* graph, State* state, Globaleventinfo* globevent) {
+    
+    // Same sums as adding the carrier after all others (Effect_potential_and_non_injection_rates), written to the carrier only
+    Node* carnode = graph->nodes[carrier->carrier_node_ID];
+    myvec carpos = carnode->node_position;
+    double RCSQR = globevent->coulcut*globevent->coulcut;
+    int carcharge = (carrier->carrier_type == Electron) ? -1 : 1;
+    
+    carrier->srfrom = 0.0;
+    for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
+        carrier->srto[jump] = 0.0;
+    }
+    
+    mesh.Gather(carpos);
+    for (unsigned int ifound = 0; ifound < mesh.found_ID.size(); ifound++) {
+        int icartype = mesh.found_type[ifound];
+        if (mesh.found_ID[ifound] == carrier->carrier_ID && icartype == (carrier->carrier_type == Electron ? 0 : 1)) continue;
+        Carrier* probecarrier = (icartype == 0) ? state->electrons[mesh.found_ID[ifound]] : state->holes[mesh.found_ID[ifound]];
+        Node* probenode = graph->nodes[probecarrier->carrier_node_ID];
+        int pair_sign = carcharge*((icartype == 0) ? -1 : 1);
         
+        myvec np_probepos = myvec(mesh.found_x[ifound], mesh.found_y[ifound], mesh.found_z[ifound]);
+        myvec distance = np_probepos-carpos;
+        double distancesqr = distance.x()*distance.x() + distance.y()*distance.y() + distance.z()*distance.z();
         
-        if(globevent->right_injection[0]){
-            Event_map = inject_node;    
-            if(globevent->left_injection[0]) Event_map = graph->nr_left_injector_nodes + inject_node;
-            El_injection_events[Event_map]->Set_injection_event(graph->right_electrode, inject_node, Electron, 0.0 , lrto, globevent);
-            El_injection_rates->setrate(Event_map,El_injection_events[Event_map]->rate);
-            el_dirty = true;
+        if((carnode->node_ID!=probenode->node_ID)&&(distancesqr<=RCSQR)) {
+            carrier->srfrom += pair_sign*Coulomb_potential(probenode,carnode,np_probepos.x(),-1.0*distance,
+                                        graph->sim_box_size,globevent);
         }
-        if(globevent->right_injection[1]){
-            Event_map = inject_node;    
-            if(globevent->left_injection[0]) Event_map = graph->nr_left_injector_nodes + inject_node;
-            Ho_injection_events[Event_map]->Set_injection_event(graph->right_electrode, inject_node, Hole, 0.0, lrto, globevent);
-            Ho_injection_rates->setrate(Event_map,Ho_injection_events[Event_map]->rate);
-            ho_dirty = true;
+        for (unsigned int jump=0; jump < carnode->pairing_nodes.size(); jump++) {
+            myvec jumpcarrierpos = carpos + carnode->static_event_info[jump].distance;
+            myvec jumpdistance = np_probepos - jumpcarrierpos;
+            double distancejumpsqr = jumpdistance.x()*jumpdistance.x() + jumpdistance.y()*jumpdistance.y() + jumpdistance.z()*jumpdistance.z();
+            if((carnode->pairing_nodes[jump] != probenode)&&(distancejumpsqr <= RCSQR)) {
+                carrier->srto[jump] += pair_sign*Coulomb_potential(probenode,carnode->pairing_nodes[jump],np_probepos.x(),-1.0*jumpdistance,
+                                         graph->sim_box_size, globevent);
+            }
         }
     }
 }
 
+void Events::Initialize_ratetrees(Ratetree_type ratetree_type, votca::tools::Random2 *RandomVariable, Graph* graph, Globaleventinfo* globevent) {
+    // non-injection events come in blocks of max_pair_degree jumps per carrier, injection events one per injector node
+    double max_rate = Max_event_rate(graph, globevent);
+    El_non_injection_rates = Create_ratetree(ratetree_type, RandomVariable, graph->max_pair_degree, max_rate);
+    Ho_non_injection_rates = Create_ratetree(ratetree_type, RandomVariable, graph->max_pair_degree, max_rate);
+    El_injection_rates = Create_ratetree(ratetree_type, RandomVariable, 1, max_rate);
+    Ho_injection_rates = Create_ratetree(ratetree_type, RandomVariable, 1, max_rate);
+    // static, no grouping or partitioning needed; a pair's rate is a share of the total generation rate
+    Generation_rates = Create_ratetree(ratetree_type, RandomVariable, 1, globevent->generation_rate);
+}
+
+// Upper bound of the transfer, injection, collection and recombination rates, after Graph::Set_static_event_rates.
+// A rate is the static factor of its jump times an energy factor of at most 1, times the collection or
+// recombination prefactor for those events.
+double Events::Max_event_rate(Graph* graph, Globaleventinfo* globevent) {
+    vector<Node*> nodes = graph->nodes;
+    if(globevent->device) {
+        nodes.push_back(graph->left_electrode);
+        nodes.push_back(graph->right_electrode);
+    }
+    double max_factor = 0.0;
+    for(unsigned int inode=0; inode<nodes.size(); inode++) {
+        for(int cartype = 0; cartype < 2; cartype++) {
+            const vector<double> &static_factor = nodes[inode]->static_factor[cartype];
+            for(unsigned int ipair=0; ipair<static_factor.size(); ipair++) {
+                max_factor = max(max_factor, static_factor[ipair]);
+            }
+        }
+    }
+    double max_prefactor = max(1.0, max(globevent->collection_prefactor, globevent->recombination_prefactor));
+    return max_factor*max_prefactor;
+}
+
+Ratetree* Events::Create_ratetree(Ratetree_type ratetree_type, votca::tools::Random2 *RandomVariable, int block_size, double max_rate) {
+    if(ratetree_type == Binary) {
+        return new Bsumtree();
+    }
+    else if(ratetree_type == Bnary) {
+        return new Bnarytree8();
+    }
+    else if(ratetree_type == Bnary_float) {
+        return new Bnarytree16f();
+    }
+    else if(ratetree_type == Composition_rejection) {
+        Crsampler* sampler = new Crsampler();
+        // own stream for the rejection step, seeded from the main one (drawn in a fixed order)
+        int seed1 = RandomVariable->rand_uniform_int(1<<30);
+        int seed2 = RandomVariable->rand_uniform_int(1<<30);
+        int seed3 = RandomVariable->rand_uniform_int(1<<30);
+        int seed4 = RandomVariable->rand_uniform_int(1<<30);
+        sampler->Set_seed(seed1, seed2, seed3, seed4);
+        return sampler;
+    }
+    else if(ratetree_type == Concurrent) {
+        Concurrentsumtree* tree = new Concurrentsumtree();
+        if(max_rate > 0.0) { tree->Set_rate_range(max_rate); } // fixed point window from the largest rate
+        return tree;
+    }
+    else if(ratetree_type == Next_reaction) {
+        Nextreactionqueue* queue = new Nextreactionqueue();
+        // 64 bit seed for the per event random streams
+        queue->Set_seed(((uint64_t) RandomVariable->rand_uniform_int(1<<30) << 32) ^ (uint64_t) RandomVariable->rand_uniform_int(1<<30));
+        return queue;
+    }
+    else if(ratetree_type == Two_level) {
+        if(block_size == 1) { return new Bsumtree(); } // nothing to group
+        Twoleveltree* tree = new Twoleveltree();
+        tree->Set_block_size(block_size);
+        return tree;
+    }
+    else if(ratetree_type == Mesh_partitioned) {
+        if(block_size == 1) { return new Bsumtree(); } // injection events do not move
+        Celltree* tree = new Celltree();
+        tree->Set_block_size(block_size);
+        return tree;
+    }
+    else {
+        throw runtime_error("unknown ratetree type");
+    }
+}
+
 void Events::Initialize_eventvector(Graph* graph, State* state, Globaleventinfo* globevent){ //
     
-    El_non_injection_events.clear();
-    Ho_non_injection_events.clear();
-    Grow_non_injection_eventvector(state->electrons.size(), state->electrons, El_non_injection_events, graph->max_pair_degree);
-    Grow_non_injection_eventvector(state->holes.size(), state->holes,Ho_non_injection_events, graph->max_pair_degree);
-    El_non_injection_rates->initialize(El_non_injection_events.size());
-    Ho_non_injection_rates->initialize(Ho_non_injection_events.size());
+    El_non_injection_events.Initialize(Electron, Carrier_source);
+    Ho_non_injection_events.Initialize(Hole, Carrier_source);
+    Grow_non_injection_eventvector(state->electrons.size(), El_non_injection_events, graph->max_pair_degree);
+    Grow_non_injection_eventvector(state->holes.size(), Ho_non_injection_events, graph->max_pair_degree);
+    El_non_injection_rates->initialize(El_non_injection_events.Size());
+    Ho_non_injection_rates->initialize(Ho_non_injection_events.Size());
+    Initialize_active_carriers(state);
     
     if(globevent->device){
-        El_injection_events.clear();
-        Ho_injection_events.clear();    
-        if(globevent->left_injection[0]) Initialize_injection_eventvector(graph->left_electrode,El_injection_events, Electron);
-        if(globevent->left_injection[1]) Initialize_injection_eventvector(graph->left_electrode,Ho_injection_events, Hole);
-        if(globevent->right_injection[0]) Initialize_injection_eventvector(graph->right_electrode,El_injection_events, Electron);
-        if(globevent->right_injection[1]) Initialize_injection_eventvector(graph->right_electrode,Ho_injection_events, Hole);
-        El_injection_rates->initialize(El_injection_events.size());
-        Ho_injection_rates->initialize(Ho_injection_events.size());
+        left_injection_table.Build(graph, graph->left_electrode, globevent);
+        right_injection_table.Build(graph, graph->right_electrode, globevent);
+        El_injection_events.Initialize(Electron, Electrode_source);
+        Ho_injection_events.Initialize(Hole, Electrode_source);
+        if(globevent->left_injection[0]) Initialize_injection_eventvector(graph->left_electrode,El_injection_events);
+        if(globevent->left_injection[1]) Initialize_injection_eventvector(graph->left_electrode,Ho_injection_events);
+        if(globevent->right_injection[0]) Initialize_injection_eventvector(graph->right_electrode,El_injection_events);
+        if(globevent->right_injection[1]) Initialize_injection_eventvector(graph->right_electrode,Ho_injection_events);
+        El_injection_rates->initialize(El_injection_events.Size());
+        Ho_injection_rates->initialize(Ho_injection_events.Size());
+    }
+    Initialize_generation(graph, state, globevent);
+}
+
+void Events::Initialize_generation(Graph* graph, State* state, Globaleventinfo* globevent) {
+    
+    // One event per node pair (electron on the node, hole on its pair), the pair weight is the product of the
+    // electron weight of the node and the hole weight of the pair in the state's inject trees.
+    // The weights are scaled so that all pairs together generate globevent->generation_rate.
+    Generation_events.Initialize(Electron, Node_source);
+    generation_dirty = false;
+    if (globevent->generation_rate <= 0.0) {
+        // no events and no tree, the group selectors leave the generation group out
+        delete Generation_rates;
+        Generation_rates = NULL;
+        return;
+    }
+    long nrevents = graph->nodes.size()*graph->max_pair_degree;
+    vector<double> weights(nrevents, 0.0);
+    double total_weight = 0.0;
+    for (unsigned int inode = 0; inode < graph->nodes.size(); inode++) {
+        Node* node = graph->nodes[inode];
+        for (int jump = 0; jump < graph->max_pair_degree; jump++) {
+            long event_ID = Generation_events.Size();
+            Generation_events.Add_event(jump, 0);
+            if (jump >= (int) node->pairing_nodes.size()) { continue; }
+            Node* pairnode = node->pairing_nodes[jump];
+            if (pairnode->node_type != Normal) { continue; }
+            Generation_events.Set_kind(event_ID, Generation);
+            weights[event_ID] = state->electron_inject->getrate(inode)*state->hole_inject->getrate(pairnode->node_ID);
+            total_weight += weights[event_ID];
+        }
     }
+    
+    Generation_rates->initialize(nrevents);
+    Ratebatch batch;
+    for (long event_ID = 0; event_ID < nrevents; event_ID++) {
+        if (weights[event_ID] > 0.0) {
+            batch.Add(event_ID, Event_rate(Generation, globevent->generation_rate*weights[event_ID]/total_weight, globevent));
+        }
+    }
+    batch.Flush(Generation_rates);
+    generation_dirty = true;
 }
 
-void Events::Initialize_injection_eventvector(Node* electrode, vector<Event*> eventvector, CarrierType cartype){
+void Events::Initialize_injection_eventvector(Node* electrode, Eventtable &eventvector){
 
+    char side = (electrode->node_type == LeftElectrode) ? 0 : 1;
     for (unsigned int inject_node = 0; inject_node<electrode->pairing_nodes.size(); inject_node++) {
-
-        Event *newEvent = new Event();
-        eventvector.push_back(newEvent);
-        newEvent->electrode = electrode;
-        newEvent->inject_cartype = cartype;
-        newEvent->tonode_ID = inject_node;
-        
+        eventvector.Add_event(inject_node, side);
     } 
 }
 
-void Events::Grow_non_injection_eventvector(int carrier_grow_size, vector<Carrier*> carriers, vector<Event*> eventvector,int max_pair_degree){
-    
-    int old_nr_carriers = div(eventvector.size(),max_pair_degree).quot; //what was the number of carriers that we started with?
+void Events::Grow_non_injection_eventvector(int carrier_grow_size, Eventtable &eventvector, int max_pair_degree){
     
-    for(int carrier_ID = old_nr_carriers; carrier_ID<old_nr_carriers+carrier_grow_size; carrier_ID++) {
+    // Event event_ID belongs to carrier event_ID/max_pair_degree and jump event_ID%max_pair_degree
+    for(int carrier_ID = 0; carrier_ID<carrier_grow_size; carrier_ID++) {
         for(int jump_ID = 0; jump_ID<max_pair_degree;jump_ID++) {
-
-            Event *newEvent = new Event();
-            eventvector.push_back(newEvent);
-
-            newEvent->carrier = carriers[carrier_ID];
-            newEvent->tonode_ID = jump_ID;
+            eventvector.Add_event(jump_ID, 0);
         }         
     }    
 }
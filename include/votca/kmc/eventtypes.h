@@ -0,0 +1,212 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_EVENTTYPES_H_
+#define __VOTCA_KMC_EVENTTYPES_H_
+
+#include <votca/kmc/carrier.h>
+#include <votca/kmc/node.h>
+#include <votca/kmc/graph.h>
+#include <votca/kmc/state.h>
+#include <votca/kmc/globaleventinfo.h>
+
+// Event types as classes with static kernels, selected at compile time. The kind of every event is stored as a tag
+// (Event_kind) in its Eventtable, Visit_event_type turns the tag into the matching class in one switch, the
+// kernels are then called directly (no virtual calls, no comparisons between types).
+// An event type provides
+//     static const Event_kind kind;
+//     static double Rate(double transfer_rate, Globaleventinfo* globevent);
+//     template <class Engine> static void Execute(Engine* engine, const Event_site &site);
+// Rate turns the rate of a plain transfer over the same pair (the rate formalism, rateformalism.h) into the rate
+// of the event. Execute changes the state through the engine (Events). A new type gets a tag and a case in
+// Visit_event_type, the other types are not affected.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+enum Event_kind {Notinbox, Transfer, Blocking, Recombination, Collection, Injection, Injection_recombination, Generation};
+
+enum action{Add, Remove };
+
+// Everything an execute kernel needs to know about the event, carrier is NULL for injection and generation events
+struct Event_site {
+    Carrier* carrier;
+    CarrierType carrier_type;
+    Node* fromnode;
+    Node* tonode;
+    Graph* graph;
+    State* state;
+    Globaleventinfo* globevent;
+};
+
+// Events of carriers outside the box and jumps the node does not have
+struct Notinbox_event {
+    static const Event_kind kind = Notinbox;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return 0.0; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {}
+};
+
+// Hop to an empty node
+struct Transfer_event {
+    static const Event_kind kind = Transfer;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return transfer_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        engine->Add_remove_carrier(Remove, site.carrier, site.graph, site.fromnode, site.state, site.globevent);
+        engine->Add_remove_carrier(Add, site.carrier, site.graph, site.tonode, site.state, site.globevent);
+    }
+};
+
+// Hop onto a carrier of the same type, switched off (keep this here for eventual simulation of bipolaron formation for example)
+struct Blocking_event {
+    static const Event_kind kind = Blocking;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return 0.0; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {}
+};
+
+// Hop onto a carrier of the other type, both carriers leave the box
+struct Recombination_event {
+    static const Event_kind kind = Recombination;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return globevent->recombination_prefactor*transfer_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        Carrier* recombined_carrier = site.tonode->carriers_on_node[0];
+        engine->Add_remove_carrier(Remove, site.carrier, site.graph, site.fromnode, site.state, site.globevent);
+        engine->Add_remove_carrier(Remove, recombined_carrier, site.graph, site.tonode, site.state, site.globevent);
+        engine->Delete_carrier(site.carrier, site.state);
+        engine->Delete_carrier(recombined_carrier, site.state);
+    }
+};
+
+// Hop into an electrode
+struct Collection_event {
+    static const Event_kind kind = Collection;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return globevent->collection_prefactor*transfer_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        engine->Add_remove_carrier(Remove, site.carrier, site.graph, site.fromnode, site.state, site.globevent);
+        engine->Delete_carrier(site.carrier, site.state);
+    }
+};
+
+// Injection from an electrode onto an empty node, the injection prefactor is part of the electrode's static factors
+struct Injection_event {
+    static const Event_kind kind = Injection;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return transfer_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        Carrier* carrier = engine->New_carrier(site.carrier_type, site.graph, site.state, site.globevent);
+        engine->Add_remove_carrier(Add, carrier, site.graph, site.tonode, site.state, site.globevent);
+    }
+};
+
+// Injection onto a carrier of the other type, which leaves the box
+struct Injection_recombination_event {
+    static const Event_kind kind = Injection_recombination;
+    static double Rate(double transfer_rate, Globaleventinfo* globevent) { return globevent->recombination_prefactor*transfer_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        Carrier* recombined_carrier = site.tonode->carriers_on_node[0];
+        engine->Add_remove_carrier(Remove, recombined_carrier, site.graph, site.tonode, site.state, site.globevent);
+        engine->Delete_carrier(recombined_carrier, site.state);
+    }
+};
+
+// Photogeneration of an exciton on a node pair that dissociates at once: an electron on fromnode, a hole on tonode.
+// The generation rates are static (State's inject trees), so generation on a pair with a carrier on either
+// node is a null event that only advances the time.
+struct Generation_event {
+    static const Event_kind kind = Generation;
+    static double Rate(double generation_rate, Globaleventinfo* globevent) { return generation_rate; }
+    template <class Engine>
+    static void Execute(Engine* engine, const Event_site &site) {
+        if (!site.fromnode->carriers_on_node.empty() || !site.tonode->carriers_on_node.empty()) { return; }
+        Carrier* electron = engine->New_carrier(Electron, site.graph, site.state, site.globevent);
+        engine->Add_remove_carrier(Add, electron, site.graph, site.fromnode, site.state, site.globevent);
+        Carrier* hole = engine->New_carrier(Hole, site.graph, site.state, site.globevent);
+        engine->Add_remove_carrier(Add, hole, site.graph, site.tonode, site.state, site.globevent);
+    }
+};
+
+// Calls visitor.template Visit<Event_type>() with the type of kind, the only place that branches on the kind
+template <class Visitor>
+inline void Visit_event_type(Event_kind kind, Visitor &visitor) {
+    switch(kind) {
+        case Transfer:
+            visitor.template Visit<Transfer_event>();
+            break;
+        case Blocking:
+            visitor.template Visit<Blocking_event>();
+            break;
+        case Recombination:
+            visitor.template Visit<Recombination_event>();
+            break;
+        case Collection:
+            visitor.template Visit<Collection_event>();
+            break;
+        case Injection:
+            visitor.template Visit<Injection_event>();
+            break;
+        case Injection_recombination:
+            visitor.template Visit<Injection_recombination_event>();
+            break;
+        case Generation:
+            visitor.template Visit<Generation_event>();
+            break;
+        case Notinbox:
+        default:
+            visitor.template Visit<Notinbox_event>();
+    }
+}
+
+// Rate of an event of the given kind from the rate of the plain transfer
+struct Event_rate_visitor {
+    Event_rate_visitor(double transfer_rate, Globaleventinfo* globevent) : transfer_rate(transfer_rate), globevent(globevent) {}
+    template <class Event_type>
+    void Visit() { rate = Event_type::Rate(transfer_rate, globevent); }
+    double transfer_rate;
+    Globaleventinfo* globevent;
+    double rate;
+};
+
+inline double Event_rate(Event_kind kind, double transfer_rate, Globaleventinfo* globevent) {
+    Event_rate_visitor visitor(transfer_rate, globevent);
+    Visit_event_type(kind, visitor);
+    return visitor.rate;
+}
+
+template <class Engine>
+struct Event_execute_visitor {
+    Event_execute_visitor(Engine* engine, const Event_site &site) : engine(engine), site(site) {}
+    template <class Event_type>
+    void Visit() { Event_type::Execute(engine, site); }
+    Engine* engine;
+    const Event_site &site;
+};
+
+template <class Engine>
+inline void Execute_event(Event_kind kind, Engine* engine, const Event_site &site) {
+    Event_execute_visitor<Engine> visitor(engine, site);
+    Visit_event_type(kind, visitor);
+}
+
+}}
+
+#endif
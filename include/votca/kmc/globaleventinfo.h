@@ -18,6 +18,8 @@
 #ifndef __VOTCA_KMC_GLOBALEVENTINFO_H_
 #define __VOTCA_KMC_GLOBALEVENTINFO_H_
 
+#include <votca/kmc/rateformalism.h>
+
 namespace votca { namespace kmc {
   
 using namespace std;
@@ -39,6 +41,7 @@ public:
     bool right_injection[2];
     bool device;
     string formalism;
+    Formalism formalism_type; // formalism resolved once, Resolve_formalism(formalism)
     
     int nr_sr_images;
     long nr_of_lr_images;
@@ -49,6 +52,7 @@ public:
     double injection_prefactor;
     double recombination_prefactor;
     double collection_prefactor;
+    double generation_rate; // electron-hole pairs generated per unit time in the whole box, 0 switches generation off
 };
 
 }} 
@@ -84,6 +84,9 @@ private:
     double Calculate_self_image_potential(double nodeposx, double length, Globaleventinfo* globevent);
 
     myvec Periodicdistance(myvec init, myvec final, myvec boxsize);    
+
+    void Set_static_event_rates(vector<Node*> &nodes, Globaleventinfo* globevent);
+    void Set_static_event_rates(Node* node, Globaleventinfo* globevent);
     
 };
 
@@ -135,6 +138,7 @@ void Graph::Load_graph(string filename, double left_electrode_distance, double r
         Init_node_mesh(sim_box_size, hopdist);
     }
     
+    Set_static_event_rates(nodes, globevent);
 }
 
 void Graph::Generate_cubic_graph(int nx, int ny, int nz, double lattice_constant,
@@ -153,6 +157,7 @@ void Graph::Generate_cubic_graph(int nx, int ny, int nz, double lattice_constant
         Set_all_self_image_potential(nodes,sim_box_size,globevent);
     }
     
+    Set_static_event_rates(nodes, globevent);
 }
 
 void Graph::Load_graph_nodes(string filename) {
@@ -430,6 +435,50 @@ void Graph::Set_all_self_image_potential(vector<Node*> nodes, myvec sim_box_size
     right_electrode->self_image_potential = 0.0;
 }
 
+void Graph::Set_static_event_rates(vector<Node*> &nodes, Globaleventinfo* globevent) {
+    
+    for(unsigned int inode=0; inode<nodes.size();inode++){
+        Set_static_event_rates(nodes[inode], globevent);
+    }
+    if(globevent->device) { // injection events start at the electrodes
+        Set_static_event_rates(left_electrode, globevent);
+        Set_static_event_rates(right_electrode, globevent);
+    }
+}
+
+void Graph::Set_static_event_rates(Node* node, Globaleventinfo* globevent) {
+    
+    // Everything in Event::Compute_event_rate that does not depend on the occupation
+    for(int cartype = 0; cartype < 2; cartype++) {
+        node->static_factor[cartype].resize(node->static_event_info.size());
+        node->static_energy[cartype].resize(node->static_event_info.size());
+        node->reorg_energy[cartype].resize(node->static_event_info.size());
+    }
+    
+    for(unsigned int ipair=0; ipair<node->static_event_info.size();ipair++){
+        Node::Static_event_info &info = node->static_event_info[ipair];
+        Node* pairnode = node->pairing_nodes[ipair];
+        double distance = abs(info.distance);
+        double injectionfactor = (node->node_type == Normal) ? 1.0 : globevent->injection_prefactor;
+        double selfimage_energy = pairnode->self_image_potential - node->self_image_potential;
+        double field_energy = globevent->efield*info.distance.x();
+        bool electrode_jump = (node->node_type != Normal) || (pairnode->node_type != Normal);
+        
+        double reorg_e = electrode_jump ? 0.0 : node->reorg_intorig_electron + pairnode->reorg_intdest_electron + info.reorg_oute;
+        double reorg_h = electrode_jump ? 0.0 : node->reorg_intorig_hole + pairnode->reorg_intdest_hole + info.reorg_outh;
+        node->reorg_energy[Electron][ipair] = reorg_e;
+        node->reorg_energy[Hole][ipair] = reorg_h;
+        
+        node->static_factor[Electron][ipair] = globevent->electron_prefactor*injectionfactor*
+                Static_factor(globevent->formalism_type, distance, info.Jeff2e, reorg_e, globevent->alpha, globevent->beta);
+        node->static_factor[Hole][ipair] = globevent->hole_prefactor*injectionfactor*
+                Static_factor(globevent->formalism_type, distance, info.Jeff2h, reorg_h, globevent->alpha, globevent->beta);
+        
+        node->static_energy[Electron][ipair] = pairnode->static_electron_node_energy - node->static_electron_node_energy + selfimage_energy - field_energy;
+        node->static_energy[Hole][ipair] = pairnode->static_hole_node_energy - node->static_hole_node_energy + selfimage_energy + field_energy;
+    }
+}
+
 double Graph::Calculate_self_image_potential(double nodeposx, double length, Globaleventinfo* globevent){
     
     double selfimagepot = 0.0;
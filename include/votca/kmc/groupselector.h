@@ -0,0 +1,111 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_GROUPSELECTOR_H_
+#define __VOTCA_KMC_GROUPSELECTOR_H_
+
+#include <tuple>
+#include <type_traits>
+
+// Direct method selection over a fixed set of rate groups, one rate tree per group.
+// The group sums live in one small array, an event is chosen with one random number:
+// the key is scaled to the total once, a prefix scan over the group sums picks the group
+// and the remainder of the key is searched in that group's tree (no divisions).
+// The tree types are template parameters, so mixed samplers are searched without virtual calls
+// when the concrete types are known (Ratetree works for any sampler). A NULL tree is a group that is switched off,
+// its sum stays 0 and it is never selected.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+template <typename... Trees>
+class Groupselector {
+public:
+    static const int nrgroups = sizeof...(Trees);
+
+    Groupselector() : total(0.0) {
+        for (int group = 0; group < nrgroups; group++) { group_sum[group] = 0.0; }
+    }
+
+    void Set_trees(Trees*... trees) { this->trees = make_tuple(trees...); }
+    void Recompute(int group); // Recompute the sum of one group after its tree was changed
+    void Recompute_all();
+    double Group_sum(int group) { return group_sum[group]; }
+    double Total() { return total; }
+
+    // randn uniform in [0,1), returns the chosen group and the event within its tree in event_ID
+    int Select(double randn, long &event_ID);
+
+private:
+    template <int I> typename enable_if<(I < nrgroups), double>::type Compute_sum_of(int group) {
+        if (group != I) { return Compute_sum_of<I+1>(group); }
+        return (get<I>(trees) != NULL) ? get<I>(trees)->compute_sum() : 0.0;
+    }
+    template <int I> typename enable_if<(I == nrgroups), double>::type Compute_sum_of(int group) { return 0.0; }
+
+    template <int I> typename enable_if<(I < nrgroups), long>::type Search_in(int group, double key) {
+        return (group == I) ? get<I>(trees)->search(key) : Search_in<I+1>(group, key);
+    }
+    template <int I> typename enable_if<(I == nrgroups), long>::type Search_in(int group, double key) { return 0; }
+
+    tuple<Trees*...> trees;
+    double group_sum[nrgroups];
+    double total;
+};
+
+template <typename... Trees>
+void Groupselector<Trees...>::Recompute(int group) {
+    group_sum[group] = Compute_sum_of<0>(group);
+    total = 0.0;
+    for (int igroup = 0; igroup < nrgroups; igroup++) { total += group_sum[igroup]; }
+}
+
+template <typename... Trees>
+void Groupselector<Trees...>::Recompute_all() {
+    total = 0.0;
+    for (int group = 0; group < nrgroups; group++) {
+        group_sum[group] = Compute_sum_of<0>(group);
+        total += group_sum[group];
+    }
+}
+
+template <typename... Trees>
+int Groupselector<Trees...>::Select(double randn, long &event_ID) {
+    double key = randn*total;
+    int group = 0;
+    int last_nonempty = -1;
+    while (group < nrgroups) {
+        if (group_sum[group] > 0.0) {
+            last_nonempty = group;
+            if (key <= group_sum[group]) { break; }
+        }
+        key -= group_sum[group]; // values are relative
+        group++;
+    }
+    if (group == nrgroups) { // rounding pushed the key past the total, take the last non-empty group
+        if (last_nonempty == -1) { event_ID = 0; return 0; } // all rates are 0
+        group = last_nonempty;
+        key = group_sum[group];
+    }
+    event_ID = Search_in<0>(group, key);
+    return group;
+}
+
+}}
+
+#endif
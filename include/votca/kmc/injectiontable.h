@@ -0,0 +1,93 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_INJECTIONTABLE_H_
+#define __VOTCA_KMC_INJECTIONTABLE_H_
+
+#include <vector>
+#include <algorithm>
+#include <votca/kmc/graph.h>
+#include <votca/kmc/cellmesh.h>
+#include <votca/kmc/coulombtable.h>
+#include <votca/kmc/globaleventinfo.h>
+
+// Injector nodes of one electrode within coulcut of every node next to that electrode, with the potential a unit
+// charge on the node causes at the injector. Carriers only change injection potentials from nodes within hopdist of
+// an electrode, and both the nodes and the injectors are static, so the lists are built once.
+// Row i of the CSR table belongs to node i and is empty for nodes further than hopdist from the electrode.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Injectiontable {
+public:
+    void Build(Graph* graph, Node* electrode, Globaleventinfo* globevent);
+
+    long First(int node_ID) { return row_start[node_ID]; }
+    long Last(int node_ID) { return row_start[node_ID+1]; }
+
+    vector<int> injector; // injector_ID (position in the electrode's pairing_nodes) of every entry
+    vector<double> potential; // potential at the injector due to a unit charge on the row's node
+
+private:
+    vector<long> row_start; // First entry of every row, nrnodes+1 entries
+};
+
+void Injectiontable::Build(Graph* graph, Node* electrode, Globaleventinfo* globevent) {
+
+    row_start.assign(graph->nodes.size()+1, 0);
+    injector.clear();
+    potential.clear();
+
+    double RC = globevent->coulcut;
+    Cellmesh mesh;
+    mesh.Initialize(graph->sim_box_size, RC, RC, false);
+    for (unsigned int injector_ID = 0; injector_ID < electrode->pairing_nodes.size(); injector_ID++) {
+        mesh.Add(0, injector_ID, electrode->pairing_nodes[injector_ID]->node_position);
+    }
+
+    vector<pair<int,double> > row;
+    for (unsigned int inode = 0; inode < graph->nodes.size(); inode++) {
+        Node* node = graph->nodes[inode];
+        myvec nodepos = node->node_position;
+        double dist_to_electrode = (electrode->node_type == LeftElectrode) ? nodepos.x() : graph->sim_box_size.x() - nodepos.x();
+
+        row.clear();
+        if (dist_to_electrode < graph->hopdist) {
+            mesh.Gather(nodepos);
+            for (unsigned int ifound = 0; ifound < mesh.found_ID.size(); ifound++) {
+                int injector_ID = mesh.found_ID[ifound];
+                if (electrode->pairing_nodes[injector_ID] == node) { continue; }
+                myvec np_injectorpos = myvec(mesh.found_x[ifound], mesh.found_y[ifound], mesh.found_z[ifound]);
+                row.push_back(make_pair(injector_ID, Coulombtable::Compute_potential(nodepos.x(), np_injectorpos-nodepos,
+                                                                                     graph->sim_box_size, globevent)));
+            }
+            sort(row.begin(), row.end());
+        }
+
+        for (unsigned int k = 0; k < row.size(); k++) {
+            injector.push_back(row[k].first);
+            potential.push_back(row[k].second);
+        }
+        row_start[inode+1] = injector.size();
+    }
+}
+
+}}
+
+#endif
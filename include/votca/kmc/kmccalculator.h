@@ -28,7 +28,7 @@ class KMCCalculator
 {
 public:
     
-    KMCCalculator() {};
+    KMCCalculator() : _nThreads(1) {};
     virtual     ~KMCCalculator() {};
     
     virtual void Initialize(const char *filename, Property *options, const char *outputfile) {}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_NEXTREACTIONGROUP_H_
+#define __VOTCA_KMC_NEXTREACTIONGROUP_H_
+
+#include <vector>
+#include <stdexcept>
+#include <votca/kmc/events.h>
+#include <votca/kmc/globaleventinfo.h>
+#include <votca/kmc/nextreactionqueue.h>
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+/*
+ * Next reaction method counterpart of Vssmgroup: the event with the earliest putative time
+ * over all event groups is executed, the simulation time jumps to that time.
+ * Needs rate trees of type Next_reaction.
+ */
+class Nextreactiongroup {
+
+public:
+
+    void Initialize_in_device(Events* events);
+    void Initialize_in_bulk(Events* events);
+    double Perform_one_step(Events* events, Graph* graph, State* state, Globaleventinfo* globevent); // Returns the time of the executed event
+
+private:
+
+    void Add_group(Ratetree* rates, Eventtable* eventvector);
+
+    vector<Nextreactionqueue*> queues;
+    vector<Eventtable*> group_events;
+
+};
+
+void Nextreactiongroup::Initialize_in_device(Events* events) {
+    queues.clear();
+    group_events.clear();
+    Add_group(events->El_non_injection_rates, &events->El_non_injection_events);
+    Add_group(events->El_injection_rates, &events->El_injection_events);
+    Add_group(events->Ho_non_injection_rates, &events->Ho_non_injection_events);
+    Add_group(events->Ho_injection_rates, &events->Ho_injection_events);
+    if(events->Generation_rates != NULL) Add_group(events->Generation_rates, &events->Generation_events);
+}
+
+void Nextreactiongroup::Initialize_in_bulk(Events* events) {
+    queues.clear();
+    group_events.clear();
+    Add_group(events->El_non_injection_rates, &events->El_non_injection_events);
+    Add_group(events->Ho_non_injection_rates, &events->Ho_non_injection_events);
+    if(events->Generation_rates != NULL) Add_group(events->Generation_rates, &events->Generation_events);
+}
+
+double Nextreactiongroup::Perform_one_step(Events* events, Graph* graph, State* state, Globaleventinfo* globevent) {
+
+    int chosen = -1;
+    double next_time = numeric_limits<double>::infinity();
+    for (unsigned int group = 0; group < queues.size(); group++) {
+        double group_time = queues[group]->Next_time();
+        if (group_time < next_time) {
+            next_time = group_time;
+            chosen = group;
+        }
+    }
+    if (chosen == -1) {
+        throw runtime_error("Next reaction method: all rates are 0");
+    }
+
+    // rate changes caused by this event are rescaled relative to its time
+    for (unsigned int group = 0; group < queues.size(); group++) {
+        queues[group]->Set_time(next_time);
+    }
+    long event_ID = queues[chosen]->Next_event();
+    queues[chosen]->Fire(event_ID);
+    events->On_execute(group_events[chosen], event_ID, graph, state, globevent);
+
+    return next_time;
+}
+
+void Nextreactiongroup::Add_group(Ratetree* rates, Eventtable* eventvector) {
+    Nextreactionqueue* queue = dynamic_cast<Nextreactionqueue*>(rates);
+    if (queue == NULL) {
+        throw runtime_error("Next reaction method needs rate trees of type next_reaction");
+    }
+    queues.push_back(queue);
+    group_events.push_back(eventvector);
+}
+
+}}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_NEXTREACTIONQUEUE_H_
+#define __VOTCA_KMC_NEXTREACTIONQUEUE_H_
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <votca/kmc/ratetree.h>
+#include <votca/kmc/philox.h>
+
+// Rate container for the next reaction method (Gibson and Bruck, J. Phys. Chem. A 104, 1876 (2000))
+// Every element keeps an absolute putative firing time, ordered in an indexed 4-ary min-heap.
+// A rate change rescales the remaining time, t' = now + (old/new)*(t - now), instead of drawing
+// a new random number. When a rate drops to 0 the remaining unit exponential is kept and used
+// again once the rate becomes nonzero.
+// Every element draws from its own counter-based random stream (seed, element, draw number),
+// so a given event sees the same random numbers whatever happens elsewhere in the device.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Nextreactionqueue : public Ratetree {
+public:
+    Nextreactionqueue() : nrelements(0), sim_time(0.0), seed(0), sum(0.0), nr_updates(0) {}
+
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+
+    void Set_seed(uint64_t seed) { this->seed = seed; }
+    void Set_time(double sim_time) { this->sim_time = sim_time; } // Rate changes are rescaled relative to this time
+    double Next_time(); // Putative time of the earliest element, infinity if all rates are 0
+    long Next_event(); // Earliest element
+    void Fire(unsigned long i); // Draws a fresh putative time for an executed element
+
+private:
+    static const unsigned long arity = 4;
+
+    double Draw_unit_exponential(unsigned long i);
+    void Update_position(unsigned long i);
+    void Sift_up(unsigned long pos);
+    void Sift_down(unsigned long pos);
+    void Heap_remove(unsigned long i);
+    void Heap_swap(unsigned long pos1, unsigned long pos2);
+
+    vector<double> element_array; // The elements (rates)
+    vector<double> time_array; // Absolute putative firing times
+    vector<double> residual_array; // Unit exponential kept while the rate is 0, -1 if none
+    vector<uint64_t> draw_array; // Number of random numbers drawn per element
+    vector<unsigned long> heap; // Elements in heap order, earliest first
+    vector<unsigned long> position_array; // Position of every element in the heap
+
+    unsigned long nrelements;
+    double sim_time;
+    uint64_t seed;
+    double sum;
+    long nr_updates; // number of incremental sum updates since the sum was last recomputed
+};
+
+void Nextreactionqueue::initialize(unsigned long nrelements) { // Must be called before use
+    this->nrelements = nrelements;
+    element_array.assign(nrelements, 0.0);
+    time_array.assign(nrelements, numeric_limits<double>::infinity());
+    residual_array.assign(nrelements, -1.0);
+    draw_array.assign(nrelements, 0);
+    heap.resize(nrelements);
+    position_array.resize(nrelements);
+    for (unsigned long i = 0; i < nrelements; i++) { // all times are infinite, so any order is a heap
+        heap[i] = i;
+        position_array[i] = i;
+    }
+    sum = 0.0;
+    nr_updates = 0;
+}
+
+void Nextreactionqueue::setrate(unsigned long i, double value) { // 0 <= i < nrelements
+    double oldvalue = element_array[i];
+    if (value == oldvalue) { return; }
+
+    if (oldvalue > 0.0) {
+        if (value > 0.0) { // rescale the remaining time
+            time_array[i] = sim_time + (oldvalue/value)*(time_array[i] - sim_time);
+        }
+        else { // keep the remaining unit exponential until the rate is nonzero again
+            residual_array[i] = oldvalue*(time_array[i] - sim_time);
+            time_array[i] = numeric_limits<double>::infinity();
+        }
+    }
+    else if (value > 0.0) {
+        double unit = (residual_array[i] >= 0.0) ? residual_array[i] : Draw_unit_exponential(i);
+        residual_array[i] = -1.0;
+        time_array[i] = sim_time + unit/value;
+    }
+
+    element_array[i] = value;
+    sum += value - oldvalue;
+    nr_updates++;
+    Update_position(i);
+}
+
+double Nextreactionqueue::getrate(long i) {
+    return element_array[i];
+}
+
+double Nextreactionqueue::compute_sum() { // Returns total sum of all elements
+    // Incremental updates accumulate round-off, recompute once per queue size worth of updates (amortised O(1))
+    if (nr_updates > (long) nrelements) {
+        sum = 0.0;
+        for (unsigned long i = 0; i < nrelements; i++) { sum += element_array[i]; }
+        nr_updates = 0;
+    }
+    return sum;
+}
+
+// Direct method fallback, same convention as Bsumtree. Linear in the number of elements,
+// the queue is meant to be driven through Next_event.
+long Nextreactionqueue::search(double searchkey) {
+    long last_nonzero = 0;
+    for (unsigned long i = 0; i < nrelements; i++) {
+        if (element_array[i] <= 0.0) { continue; }
+        last_nonzero = i;
+        if (searchkey <= element_array[i]) { break; }
+        searchkey -= element_array[i];
+    }
+    return last_nonzero;
+}
+
+void Nextreactionqueue::resize(unsigned long newsize) {
+    /*
+     *  When newsize >= oldsize: all elements are kept, new elements are 0.
+     *  When newsize < oldsize: excess elements are removed from the heap and thrown away.
+     */
+    for (unsigned long i = nrelements; i > newsize; i--) {
+        setrate(i-1, 0.0);
+        Heap_remove(i-1);
+    }
+    element_array.resize(newsize, 0.0);
+    time_array.resize(newsize, numeric_limits<double>::infinity());
+    residual_array.resize(newsize, -1.0);
+    draw_array.resize(newsize, 0);
+    position_array.resize(newsize);
+    for (unsigned long i = nrelements; i < newsize; i++) { // infinite times can be appended to the heap
+        position_array[i] = heap.size();
+        heap.push_back(i);
+    }
+    nrelements = newsize;
+}
+
+long Nextreactionqueue::getnrrates() {
+    return nrelements;
+}
+
+double Nextreactionqueue::Next_time() {
+    if (heap.empty()) { return numeric_limits<double>::infinity(); }
+    return time_array[heap[0]];
+}
+
+long Nextreactionqueue::Next_event() {
+    return heap[0];
+}
+
+void Nextreactionqueue::Fire(unsigned long i) {
+    // The executed element needs a new unit exponential, later rate changes rescale it
+    residual_array[i] = -1.0;
+    if (element_array[i] > 0.0) {
+        time_array[i] = sim_time + Draw_unit_exponential(i)/element_array[i];
+    }
+    else {
+        time_array[i] = numeric_limits<double>::infinity();
+    }
+    Update_position(i);
+}
+
+double Nextreactionqueue::Draw_unit_exponential(unsigned long i) {
+    // counter-based stream (seed, element, draw number)
+    double u = 1.0 - Philox::Uniform(seed, i, draw_array[i]++); // (0,1]
+    return -log(u);
+}
+
+void Nextreactionqueue::Update_position(unsigned long i) {
+    Sift_up(position_array[i]);
+    Sift_down(position_array[i]);
+}
+
+void Nextreactionqueue::Sift_up(unsigned long pos) {
+    while (pos > 0) {
+        unsigned long parent = (pos-1)/arity;
+        if (time_array[heap[parent]] <= time_array[heap[pos]]) { break; }
+        Heap_swap(pos, parent);
+        pos = parent;
+    }
+}
+
+void Nextreactionqueue::Sift_down(unsigned long pos) {
+    while (true) {
+        unsigned long first = arity*pos+1;
+        if (first >= heap.size()) { break; }
+        unsigned long last = (first+arity < heap.size()) ? first+arity : heap.size();
+        unsigned long smallest = first;
+        for (unsigned long child = first+1; child < last; child++) {
+            if (time_array[heap[child]] < time_array[heap[smallest]]) { smallest = child; }
+        }
+        if (time_array[heap[pos]] <= time_array[heap[smallest]]) { break; }
+        Heap_swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void Nextreactionqueue::Heap_remove(unsigned long i) {
+    unsigned long pos = position_array[i];
+    Heap_swap(pos, heap.size()-1);
+    heap.pop_back();
+    if (pos < heap.size()) {
+        Sift_up(pos);
+        Sift_down(pos);
+    }
+}
+
+void Nextreactionqueue::Heap_swap(unsigned long pos1, unsigned long pos2) {
+    unsigned long element1 = heap[pos1];
+    unsigned long element2 = heap[pos2];
+    heap[pos1] = element2;
+    heap[pos2] = element1;
+    position_array[element2] = pos1;
+    position_array[element1] = pos2;
+}
+
+}}
+
+#endif
@@ -55,6 +55,12 @@ public:
     myvec node_position;
     vector<Node*> pairing_nodes;
     vector<Static_event_info> static_event_info;
+    
+    // Static part of the rate of every jump, per carrier type ([Electron], [Hole]), set by Graph::Set_static_event_rates.
+    // Arrays instead of Static_event_info fields, so all jumps of a carrier are evaluated in one vectorised loop.
+    vector<double> static_factor[2]; // prefactors and the static factor of the formalism
+    vector<double> static_energy[2]; // static energy difference, including self image potential and field
+    vector<double> reorg_energy[2]; // total reorganisation energy, 0 for jumps from or to an electrode
     vector<Carrier*> carriers_on_node;
     
     int layer_index;
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_PHILOX_H_
+#define __VOTCA_KMC_PHILOX_H_
+
+#include <stdint.h>
+
+// Counter-based random number generator, Philox4x32-10 (Salmon et al., SC'11).
+// The random numbers are a pure function of (seed, stream, counter): the seed is the key, the
+// 128 bit counter holds the stream in the upper and the block number in the lower half.
+// Every thread, run, carrier or domain takes its own stream, so results do not depend on
+// scheduling, and the state of a stream is its counter (all a checkpoint has to store).
+// The counter counts 32 bit words, a block holds four. rand_uint32 takes one word, rand_uniform
+// the next aligned pair of words (a single word left over by rand_uint32 is skipped).
+// rand_uniform/rand_uniform_int follow the Random2 interface, so it drops in where Random2 was used.
+
+namespace votca { namespace kmc {
+
+class Philox {
+public:
+    Philox() { Init(0, 0); }
+    Philox(uint64_t seed, uint64_t stream, uint64_t counter = 0) { Init(seed, stream, counter); }
+
+    void Init(uint64_t seed, uint64_t stream, uint64_t counter = 0);
+    uint64_t Get_counter() { return counter; } // Number of 32 bit words used so far
+    void Set_counter(uint64_t counter) { this->counter = counter; }
+
+    double rand_uniform(); // uniform in [0,1), 53 bits
+    int rand_uniform_int(int max_int); // uniform in 0..max_int-1
+    uint32_t rand_uint32(); // 32 random bits (one word)
+
+    // Stateless draw number counter of stream (seed, stream), the same as rand_uniform at word 2*counter
+    static double Uniform(uint64_t seed, uint64_t stream, uint64_t counter);
+
+private:
+    static void Block(uint64_t seed, uint64_t stream, uint64_t block_number, uint32_t result[4]);
+    static double To_uniform(uint32_t hi, uint32_t lo);
+
+    uint64_t seed;
+    uint64_t stream;
+    uint64_t counter;
+    uint32_t block[4]; // Cached output of block block_number, words 4*block_number..4*block_number+3
+    uint64_t block_number;
+};
+
+void Philox::Init(uint64_t seed, uint64_t stream, uint64_t counter) {
+    this->seed = seed;
+    this->stream = stream;
+    this->counter = counter;
+    block_number = 0;
+    Block(seed, stream, block_number, block);
+}
+
+inline double Philox::rand_uniform() {
+    uint64_t word = (counter + 1) & ~(uint64_t) 1; // two words, aligned so they never straddle two blocks
+    counter = word + 2;
+    if (word/4 != block_number) {
+        block_number = word/4;
+        Block(seed, stream, block_number, block);
+    }
+    return To_uniform(block[word%4], block[word%4+1]);
+}
+
+inline int Philox::rand_uniform_int(int max_int) {
+    int i = (int) (rand_uniform()*max_int);
+    return (i < max_int) ? i : max_int-1;
+}
+
+inline uint32_t Philox::rand_uint32() {
+    uint64_t word = counter++;
+    if (word/4 != block_number) {
+        block_number = word/4;
+        Block(seed, stream, block_number, block);
+    }
+    return block[word%4];
+}
+
+inline double Philox::Uniform(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint32_t result[4];
+    Block(seed, stream, counter/2, result);
+    int word = 2*(counter%2);
+    return To_uniform(result[word], result[word+1]);
+}
+
+inline void Philox::Block(uint64_t seed, uint64_t stream, uint64_t block_number, uint32_t result[4]) {
+    uint32_t c0 = (uint32_t) block_number;
+    uint32_t c1 = (uint32_t) (block_number >> 32);
+    uint32_t c2 = (uint32_t) stream;
+    uint32_t c3 = (uint32_t) (stream >> 32);
+    uint32_t k0 = (uint32_t) seed;
+    uint32_t k1 = (uint32_t) (seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        uint64_t product0 = (uint64_t) 0xD2511F53U*c0;
+        uint64_t product1 = (uint64_t) 0xCD9E8D57U*c2;
+        uint32_t n0 = (uint32_t) (product1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t) (product0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) product1;
+        c3 = (uint32_t) product0;
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9U; // Weyl sequence for the round keys
+        k1 += 0xBB67AE85U;
+    }
+    result[0] = c0; result[1] = c1; result[2] = c2; result[3] = c3;
+}
+
+inline double Philox::To_uniform(uint32_t hi, uint32_t lo) {
+    uint64_t bits = (((uint64_t) hi << 32) | lo) >> 11;
+    return bits*(1.0/9007199254740992.0);
+}
+
+}}
+
+#endif
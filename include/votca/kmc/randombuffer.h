@@ -0,0 +1,142 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_RANDOMBUFFER_H_
+#define __VOTCA_KMC_RANDOMBUFFER_H_
+
+#include <cstring>
+#include <stdint.h>
+#include <votca/tools/random2.h>
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+/*
+ * Buffered random variates for the hot loops: uniforms and unit exponentials are produced
+ * a block at a time and handed out one by one. The exponential block is transformed with a
+ * branch free logarithm that the compiler vectorises, so a time step costs a load instead
+ * of a generator call, a retry loop and a scalar log.
+ * Generator is any class with rand_uniform() in [0,1) (Random2, Philox).
+ */
+template <typename Generator = votca::tools::Random2>
+class Randombuffer {
+public:
+    Randombuffer() : RandomVariable(NULL), next_uniform(block_size), next_exponential(block_size) {}
+
+    void Set_RNG(Generator *RandomVariable);
+    void Reset(); // Throw away buffered numbers, e.g. after the generator was reseeded
+    double Uniform(); // uniform in [0,1)
+    double Exponential(); // unit exponential, -log(u) with u in (0,1]
+
+private:
+    static const int block_size = 256;
+
+    void Fill_uniform();
+    void Fill_exponential();
+    static void Log_block(const double* x, double* result, int n);
+
+    Generator *RandomVariable;
+    double uniform_block[block_size];
+    double exponential_block[block_size];
+    int next_uniform;
+    int next_exponential;
+};
+
+template <typename Generator>
+void Randombuffer<Generator>::Set_RNG(Generator *RandomVariable) {
+    if (this->RandomVariable == RandomVariable) { return; }
+    this->RandomVariable = RandomVariable;
+    Reset(); // numbers of another generator are thrown away
+}
+
+template <typename Generator>
+void Randombuffer<Generator>::Reset() {
+    next_uniform = block_size;
+    next_exponential = block_size;
+}
+
+template <typename Generator>
+inline double Randombuffer<Generator>::Uniform() {
+    if (next_uniform == block_size) { Fill_uniform(); }
+    return uniform_block[next_uniform++];
+}
+
+template <typename Generator>
+inline double Randombuffer<Generator>::Exponential() {
+    if (next_exponential == block_size) { Fill_exponential(); }
+    return exponential_block[next_exponential++];
+}
+
+template <typename Generator>
+void Randombuffer<Generator>::Fill_uniform() {
+    for (int k = 0; k < block_size; k++) {
+        uniform_block[k] = RandomVariable->rand_uniform();
+    }
+    next_uniform = 0;
+}
+
+template <typename Generator>
+void Randombuffer<Generator>::Fill_exponential() {
+    double u[block_size];
+    for (int k = 0; k < block_size; k++) {
+        u[k] = 1.0 - RandomVariable->rand_uniform(); // (0,1], so the log is always finite
+    }
+    Log_block(u, exponential_block, block_size);
+    for (int k = 0; k < block_size; k++) {
+        exponential_block[k] = -exponential_block[k];
+    }
+    next_exponential = 0;
+}
+
+template <typename Generator>
+void Randombuffer<Generator>::Log_block(const double* x, double* result, int n) {
+    // log(x) = e*log(2) + 2*atanh(s), s = (m-1)/(m+1), for x = m*2^e with m in [sqrt(1/2),sqrt(2))
+    // |s| < 0.172, so the odd series up to s^21 is accurate to double precision. Valid for positive normal x.
+    const double ln2 = 0.69314718055994530942;
+    const double sqrt_half = 0.70710678118654752440;
+    for (int k = 0; k < n; k++) {
+        uint64_t bits;
+        memcpy(&bits, &x[k], sizeof(double));
+        double exponent = (double) ((int64_t) (bits >> 52) - 1022);
+        bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FE0000000000000ULL; // mantissa in [1/2,1)
+        double m;
+        memcpy(&m, &bits, sizeof(double));
+        double shift = (m < sqrt_half) ? 1.0 : 0.0;
+        m += m*shift;
+        exponent -= shift;
+
+        double s = (m - 1.0)/(m + 1.0);
+        double s2 = s*s;
+        double series = 1.0/21.0;
+        series = series*s2 + 1.0/19.0;
+        series = series*s2 + 1.0/17.0;
+        series = series*s2 + 1.0/15.0;
+        series = series*s2 + 1.0/13.0;
+        series = series*s2 + 1.0/11.0;
+        series = series*s2 + 1.0/9.0;
+        series = series*s2 + 1.0/7.0;
+        series = series*s2 + 1.0/5.0;
+        series = series*s2 + 1.0/3.0;
+        series = series*s2 + 1.0;
+        result[k] = exponent*ln2 + 2.0*s*series;
+    }
+}
+
+}}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_RATEFORMALISM_H_
+#define __VOTCA_KMC_RATEFORMALISM_H_
+
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+
+// Rate formalisms as policies for Event::Compute_event_rate. The formalism string is resolved
+// once into Formalism (Resolve_formalism), every rate evaluation then calls the policy of the
+// chosen formalism directly instead of comparing strings or going through virtual calls.
+// A policy provides
+//     static double Static_factor(double distance, double Jeff2, double reorg, double alpha, double beta);
+//     static double Energy_factor(double energycontrib, double reorg, double beta);
+// Static_factor is evaluated once per jump at graph setup, Energy_factor on every rate evaluation
+// with the energy difference (final minus initial, including the field term). Energy_factor
+// must be branch free (selects only), so a carrier's jumps are evaluated in one vectorised loop.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+enum Formalism {Miller, Marcus, Custom};
+
+inline Formalism Resolve_formalism(const string &formalism) {
+    if (formalism == "Miller") { return Miller; }
+    if (formalism == "Marcus") { return Marcus; }
+    if (formalism == "Custom") { return Custom; }
+    throw runtime_error("Invalid formalism '" + formalism + "', energyfactor is undefined");
+}
+
+// exp(x) for x <= 0, branch free so it vectorises. x = k*log(2) + r with |r| <= log(2)/2, exp(r) from
+// its Taylor series up to r^12 (within a few ulp). Arguments below -708 return exp(-708).
+inline double Fast_exp(double x) {
+    const double log2e = 1.44269504088896340736;
+    const double ln2_hi = 6.93147180369123816490e-01; // log(2) split in two parts, k*ln2_hi is exact
+    const double ln2_lo = 1.90821492927058770002e-10;
+    const double round_shift = 6755399441055744.0; // 1.5*2^52, adding it rounds to an integer kept in the low bits
+    x += (-708.0 - x > 0.0) ? -708.0 - x : 0.0; // clamp, written so that it stays a select
+    double shifted = x*log2e + round_shift;
+    double k = shifted - round_shift;
+    double r = (x - k*ln2_hi) - k*ln2_lo;
+    double p = 1.0/479001600.0;
+    p = p*r + 1.0/39916800.0;
+    p = p*r + 1.0/3628800.0;
+    p = p*r + 1.0/362880.0;
+    p = p*r + 1.0/40320.0;
+    p = p*r + 1.0/5040.0;
+    p = p*r + 1.0/720.0;
+    p = p*r + 1.0/120.0;
+    p = p*r + 1.0/24.0;
+    p = p*r + 1.0/6.0;
+    p = p*r + 0.5;
+    p = p*r + 1.0;
+    p = p*r + 1.0;
+    uint64_t kbits;
+    uint64_t shiftbits;
+    memcpy(&kbits, &shifted, sizeof(double));
+    memcpy(&shiftbits, &round_shift, sizeof(double));
+    uint64_t bits = (kbits - shiftbits + 1023) << 52; // 2^k
+    double scale;
+    memcpy(&scale, &bits, sizeof(double));
+    return p*scale;
+}
+
+// Miller-Abrahams: exponential decay with distance, uphill hops are Boltzmann suppressed, downhill hops are not
+struct Miller_formalism {
+    static double Static_factor(double distance, double Jeff2, double reorg, double alpha, double beta) {
+        return exp(-1.0*alpha*distance);
+    }
+    static double Energy_factor(double energycontrib, double reorg, double beta) {
+        return Fast_exp(-beta*((energycontrib > 0.0) ? energycontrib : 0.0));
+    }
+};
+
+// Marcus: 2*Pi/hbar*Jeff2/sqrt(4*Pi*reorg*kT)*exp(-(dE+reorg)^2/(4*reorg*kT)), beta = 1/kT.
+// Jumps without reorganisation energy (from or to an electrode, or graphs without reorganisation energies) keep the Miller form.
+struct Marcus_formalism {
+    static double Static_factor(double distance, double Jeff2, double reorg, double alpha, double beta) {
+        const double Pi = 3.14159265358979323846;
+        const double hbar = 6.5821192815E-16; // eV*s
+        if (reorg <= 0.0) { return Miller_formalism::Static_factor(distance, Jeff2, reorg, alpha, beta); }
+        return 2.0*Pi/hbar*Jeff2/sqrt(4.0*Pi*reorg/beta);
+    }
+    static double Energy_factor(double energycontrib, double reorg, double beta) {
+        // Both exponents are computed and blended, so the loop over a carrier's jumps has no branches
+        double marcus_weight = (reorg > 0.0) ? 1.0 : 0.0;
+        double safe_reorg = reorg + (1.0 - marcus_weight); // any positive value where the Marcus exponent is not used
+        double shifted = energycontrib + safe_reorg;
+        double marcus_exponent = beta*shifted*shifted/(4.0*safe_reorg);
+        double miller_exponent = beta*((energycontrib > 0.0) ? energycontrib : 0.0);
+        return Fast_exp(-1.0*(miller_exponent + marcus_weight*(marcus_exponent - miller_exponent)));
+    }
+};
+
+// Hook for user defined kernels: specialise Custom_formalism<0> with the two policy functions and
+// select it with formalism "Custom". Unspecialised it behaves as Miller.
+template <int kernel_ID>
+struct Custom_formalism : public Miller_formalism {};
+
+// Setup time dispatch of the static factor
+inline double Static_factor(Formalism formalism, double distance, double Jeff2, double reorg, double alpha, double beta) {
+    switch(formalism) {
+        case Marcus:
+            return Marcus_formalism::Static_factor(distance, Jeff2, reorg, alpha, beta);
+        case Custom:
+            return Custom_formalism<0>::Static_factor(distance, Jeff2, reorg, alpha, beta);
+        case Miller:
+        default:
+            return Miller_formalism::Static_factor(distance, Jeff2, reorg, alpha, beta);
+    }
+}
+
+}}
+
+#endif
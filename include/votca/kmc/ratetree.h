@@ -0,0 +1,88 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_RATETREE_H_
+#define __VOTCA_KMC_RATETREE_H_
+
+#include <vector>
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+enum Ratetree_type {Binary, Bnary, Bnary_float, Composition_rejection, Concurrent, Next_reaction, Two_level, Mesh_partitioned};
+
+/*
+ * Abstract base class for all rate samplers (setrate/compute_sum/search bookkeeping)
+ */
+class Ratetree {
+public:
+    virtual ~Ratetree() {}
+
+    virtual void initialize(unsigned long nrelements) = 0;
+    virtual void setrate(unsigned long i, double value) = 0;
+    virtual void setrates(const unsigned long* indices, const double* values, unsigned long n);
+    virtual double getrate(long i) = 0;
+    virtual double compute_sum() = 0;
+    virtual long search(double searchkey) = 0;
+    virtual void search_many(const double* sorted_keys, long* out, unsigned long K);
+    virtual void resize(unsigned long newsize) = 0;
+    virtual long getnrrates() = 0;
+    // Spatial hint: block (carrier) now lives in coulomb mesh cell, ignored by unpartitioned samplers
+    virtual void set_cell(unsigned long block, unsigned long cell) {}
+};
+
+void Ratetree::setrates(const unsigned long* indices, const double* values, unsigned long n) {
+    // Default for samplers without a bulk update
+    for (unsigned long k = 0; k < n; k++) {
+        setrate(indices[k], values[k]);
+    }
+}
+
+void Ratetree::search_many(const double* sorted_keys, long* out, unsigned long K) {
+    // Default for samplers without a shared traversal
+    for (unsigned long k = 0; k < K; k++) {
+        out[k] = search(sorted_keys[k]);
+    }
+}
+
+/*
+ * Collects the rate updates of one step, so they reach the rate tree in one setrates call
+ */
+class Ratebatch {
+public:
+    void Add(unsigned long i, double value) {
+        indices.push_back(i);
+        values.push_back(value);
+    }
+    void Flush(Ratetree* ratetree) {
+        if (!indices.empty()) {
+            ratetree->setrates(&indices[0], &values[0], indices.size());
+            indices.clear();
+            values.clear();
+        }
+    }
+    bool Empty() { return indices.empty(); }
+
+private:
+    vector<unsigned long> indices;
+    vector<double> values;
+};
+
+}}
+
+#endif
@@ -27,6 +27,7 @@
 #include <votca/kmc/graph.h>
 #include <votca/kmc/globaleventinfo.h>
 #include <votca/kmc/bsumtree.h>
+#include <votca/kmc/cellmesh.h>
 
 typedef votca::tools::vec myvec;
 
@@ -47,9 +48,9 @@ public:
     void Init();
 
     // Buying/Selling of carrier numbers from the reservoir
-    unsigned int Buy(vector <Carrier*> carriers, vector <int> carrier_reservoir);
-    void Sell(vector <Carrier*> carriers, vector <int> carrier_reservoir, unsigned int remove_from_sim_box);
-    void Grow(vector <Carrier*> carriers, vector <int> carrier_reservoir, unsigned int nr_new_carriers, int max_pair_degree);
+    unsigned int Buy(vector <Carrier*> &carriers, vector <int> &carrier_reservoir);
+    void Sell(vector <Carrier*> &carriers, vector <int> &carrier_reservoir, unsigned int remove_from_sim_box);
+    void Grow(vector <Carrier*> &carriers, vector <int> &carrier_reservoir, unsigned int nr_new_carriers, int max_pair_degree);
     
     vector<Carrier*> electrons; //change
     vector<int> electron_reservoir;
@@ -58,14 +59,15 @@ public:
 
     string SQL_state_filename;
 
-    // Creation of coulomb mesh
+    // Creation of coulomb mesh (flat cell list of the carriers in the box)
     int meshsizeX; int meshsizeY; int meshsizeZ;
-    vector< vector< vector< vector <list<int> > > > > coulomb_mesh;
+    Cellmesh coulomb_mesh;
     void Init_coulomb_mesh(Graph* graph, Globaleventinfo* globevent);
     void Add_to_coulomb_mesh(Graph* graph, Carrier* carrier, Globaleventinfo* globevent);
     void Remove_from_coulomb_mesh(Graph* graph, Carrier* carrier, Globaleventinfo* globevent);
+    long Coulomb_mesh_cell(Graph* graph, Carrier* carrier, Globaleventinfo* globevent); // Flat index of the carrier's mesh cell
     
-    // Injection and removal of charges (for example in a double carrier bulk setting) (still to be done)
+    // Node weights for placing charges (for example in a double carrier bulk setting), used for the generation rates
     Bsumtree* electron_inject;
     Bsumtree* hole_inject;
     void Initialize_inject_trees(Graph* graph, Inject_Type injecttype, Globaleventinfo* globevent);
@@ -102,27 +104,19 @@ void State::Init(){
 }
 
 void State::Init_coulomb_mesh(Graph* graph, Globaleventinfo* globevent){
-    meshsizeX = ceil(graph->sim_box_size.x()/globevent->coulcut);
-    meshsizeY = ceil(graph->sim_box_size.y()/globevent->coulcut);
-    meshsizeZ = ceil(graph->sim_box_size.z()/globevent->coulcut);
-    
-    coulomb_mesh.resize(meshsizeX);
-    for(int i = 0;i<meshsizeX;i++) {
-        coulomb_mesh[i].resize(meshsizeY);
-        for(int j = 0;j<meshsizeY;j++) {
-            coulomb_mesh[i][j].resize(meshsizeZ);
-            for(int k=0;k<meshsizeZ;k++) {
-                coulomb_mesh[i][j][k].resize(2);
-            }
-        }
-    }
+
+    // Gather has to find every carrier that interacts with the moving carrier or one of its jump targets
+    coulomb_mesh.Initialize(graph->sim_box_size, globevent->coulcut, globevent->coulcut + graph->hopdist, !globevent->device);
+    meshsizeX = coulomb_mesh.meshsizeX;
+    meshsizeY = coulomb_mesh.meshsizeY;
+    meshsizeZ = coulomb_mesh.meshsizeZ;
     
     for(unsigned int ic=0;ic<electrons.size();ic++){
-        Add_to_coulomb_mesh(graph, electrons[ic], globevent);
+        if(electrons[ic]->is_in_sim_box) Add_to_coulomb_mesh(graph, electrons[ic], globevent);
     }
 
     for(unsigned int ic=0;ic<holes.size();ic++){
-        Add_to_coulomb_mesh(graph, holes[ic], globevent);
+        if(holes[ic]->is_in_sim_box) Add_to_coulomb_mesh(graph, holes[ic], globevent);
     }
 }
 
@@ -138,15 +132,7 @@ void State::Add_to_coulomb_mesh(Graph* graph, Carrier* carrier, Globaleventinfo*
         throw runtime_error("carrier->carrier_type should be Hole or Electron");
     }
     
-    double posx = graph->nodes[carrier->carrier_node_ID]->node_position.x();
-    double posy = graph->nodes[carrier->carrier_node_ID]->node_position.y();
-    double posz = graph->nodes[carrier->carrier_node_ID]->node_position.z();
-        
-    int iposx = floor(posx/globevent->coulcut); 
-    int iposy = floor(posy/globevent->coulcut); 
-    int iposz = floor(posz/globevent->coulcut);
-    
-    coulomb_mesh[iposx][iposy][iposz][charge].push_back(carrier->carrier_ID);    
+    coulomb_mesh.Add(charge, carrier->carrier_ID, graph->nodes[carrier->carrier_node_ID]->node_position);
 }
 
 void State::Remove_from_coulomb_mesh(Graph* graph, Carrier* carrier, Globaleventinfo* globevent){
@@ -161,17 +147,13 @@ void State::Remove_from_coulomb_mesh(Graph* graph, Carrier* carrier, Globalevent
         throw runtime_error("carrier->carrier_type should be Hole or Electron");
     }
     
-    double posx = graph->nodes[carrier->carrier_node_ID]->node_position.x();
-    double posy = graph->nodes[carrier->carrier_node_ID]->node_position.y();
-    double posz = graph->nodes[carrier->carrier_node_ID]->node_position.z();
-        
-    int iposx = floor(posx/globevent->coulcut); 
-    int iposy = floor(posy/globevent->coulcut); 
-    int iposz = floor(posz/globevent->coulcut);
-    
-    coulomb_mesh[iposx][iposy][iposz][charge].remove(carrier->carrier_ID);    
+    coulomb_mesh.Remove(charge, carrier->carrier_ID);
 }    
 
+long State::Coulomb_mesh_cell(Graph* graph, Carrier* carrier, Globaleventinfo* globevent){
+
+    return coulomb_mesh.Cell_of(graph->nodes[carrier->carrier_node_ID]->node_position);
+}
 
 void State::Save(string SQL_state_filename){
     
@@ -259,7 +241,7 @@ void State::Load(string SQL_state_filename, Graph* graph, Globaleventinfo* globe
     stmt = NULL;    
 }
 
-unsigned int State::Buy(vector <Carrier*> carriers, vector <int> carrier_reservoir) {
+unsigned int State::Buy(vector <Carrier*> &carriers, vector <int> &carrier_reservoir) {
     
     unsigned int carriernr_to_sim_box = carrier_reservoir.back();
     carrier_reservoir.pop_back();
@@ -267,13 +249,13 @@ unsigned int State::Buy(vector <Carrier*> carriers, vector <int> carrier_reservo
     return carriernr_to_sim_box;
 }
 
-void State::Sell(vector <Carrier*> carriers, vector <int> carrier_reservoir, unsigned int remove_from_sim_box) {
+void State::Sell(vector <Carrier*> &carriers, vector <int> &carrier_reservoir, unsigned int remove_from_sim_box) {
     
     carrier_reservoir.push_back(remove_from_sim_box);
     carriers[remove_from_sim_box]->is_in_sim_box = false;
 }
 
-void State::Grow(vector <Carrier*> carriers, vector <int> carrier_reservoir, unsigned int nr_new_carriers, int max_pair_degree) {
+void State::Grow(vector <Carrier*> &carriers, vector <int> &carrier_reservoir, unsigned int nr_new_carriers, int max_pair_degree) {
     
     unsigned int new_nr_carriers = carriers.size() + nr_new_carriers;
     for (unsigned int i=carriers.size(); i<new_nr_carriers; i++) {
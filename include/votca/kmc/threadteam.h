@@ -0,0 +1,163 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_THREADTEAM_H_
+#define __VOTCA_KMC_THREADTEAM_H_
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <votca/tools/thread.h>
+
+// A small team of threads that stays alive between tasks, for work that is too short to pay for
+// starting threads (the neighbour updates of a single step). Run splits a task in one part per
+// team member; the calling thread does part 0 and returns once every part is done. An exception
+// from any part is rethrown by Run after all parts have finished.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Teamtask {
+public:
+    virtual ~Teamtask() {}
+    virtual void Run_part(int part, int nrparts) = 0;
+};
+
+class Threadteam {
+public:
+    Threadteam() : generation(0), pending(0), quit(false), task(NULL) {}
+    ~Threadteam() { Stop(); }
+
+    void Start(int nthreads); // nthreads-1 members next to the calling thread
+    int Size() { return members.size()+1; }
+    void Run(Teamtask* task);
+
+private:
+    class Member : public votca::tools::Thread {
+    public:
+        Member(Threadteam* team, int part) : team(team), part(part), seen(team->generation) {}
+        void Run(void);
+    private:
+        Threadteam* team;
+        int part;
+        long seen; // last task taken
+    };
+
+    void Stop();
+    exception_ptr Wait_for_members(); // Returns the first exception of a member in the current task
+
+    vector<Member*> members;
+    mutex team_mutex;
+    condition_variable start; // a new task is available
+    condition_variable done; // the last member finished its part
+    long generation; // number of tasks handed out
+    int pending; // members still working on the current task
+    bool quit;
+    Teamtask* task;
+    exception_ptr member_error;
+};
+
+void Threadteam::Start(int nthreads) {
+    Stop();
+    quit = false;
+    for (int part = 1; part < nthreads; part++) {
+        members.push_back(new Member(this, part));
+    }
+    for (unsigned int i = 0; i < members.size(); i++) { members[i]->Start(); }
+}
+
+void Threadteam::Stop() {
+    if (members.empty()) { return; }
+    {
+        lock_guard<mutex> lock(team_mutex);
+        quit = true;
+    }
+    start.notify_all();
+    for (unsigned int i = 0; i < members.size(); i++) {
+        members[i]->WaitDone();
+        delete members[i];
+    }
+    members.clear();
+}
+
+void Threadteam::Run(Teamtask* task) {
+    int nrparts = Size();
+    if (nrparts == 1) {
+        task->Run_part(0, 1);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(team_mutex);
+        this->task = task;
+        pending = members.size();
+        generation++;
+    }
+    start.notify_all();
+
+    try {
+        task->Run_part(0, nrparts);
+    }
+    catch (...) {
+        Wait_for_members(); // the members still work on the task
+        throw;
+    }
+    exception_ptr error = Wait_for_members();
+    if (error) { rethrow_exception(error); }
+}
+
+exception_ptr Threadteam::Wait_for_members() {
+    unique_lock<mutex> lock(team_mutex);
+    while (pending > 0) { done.wait(lock); }
+    task = NULL;
+    exception_ptr error = member_error;
+    member_error = exception_ptr();
+    return error;
+}
+
+void Threadteam::Member::Run(void) {
+    while (true) {
+        Teamtask* task;
+        int nrparts;
+        {
+            unique_lock<mutex> lock(team->team_mutex);
+            while (team->generation == seen && !team->quit) { team->start.wait(lock); }
+            if (team->quit) { return; }
+            seen = team->generation;
+            task = team->task;
+            nrparts = team->members.size()+1;
+        }
+
+        exception_ptr error;
+        try {
+            task->Run_part(part, nrparts);
+        }
+        catch (...) {
+            error = current_exception();
+        }
+
+        lock_guard<mutex> lock(team->team_mutex);
+        if (error && !team->member_error) { team->member_error = error; }
+        if (--team->pending == 0) { team->done.notify_one(); }
+    }
+}
+
+}}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2009-2013 The VOTCA Development Team (http://www.votca.org)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __VOTCA_KMC_TWOLEVELTREE_H_
+#define __VOTCA_KMC_TWOLEVELTREE_H_
+
+#include <vector>
+#include <votca/kmc/ratetree.h>
+#include <votca/kmc/bsumtree.h>
+
+// Two-level rate tree for events indexed as block*block_size + slot (carrier_ID*max_pair_degree + jump).
+// A Bsumtree holds one escape rate per block (carrier), the slot within the block is found by a linear
+// scan over the block's used slots only. The binary tree is block_size times smaller, so an update of
+// a carrier's jumps touches one short spine, and padding slots (nodes with fewer neighbours than
+// max_pair_degree) are never summed or scanned.
+
+namespace votca { namespace kmc {
+
+using namespace std;
+
+class Twoleveltree : public Ratetree {
+public:
+    Twoleveltree() : block_size(1), nrelements(0) {}
+
+    void Set_block_size(unsigned long block_size) { this->block_size = block_size; } // Before initialize
+    void initialize(unsigned long nrelements);
+    void setrate(unsigned long i, double value);
+    double getrate(long i);
+    double compute_sum();
+    long search(double searchkey);
+    void resize(unsigned long newsize);
+    long getnrrates();
+
+private:
+    double Block_sum(unsigned long block);
+
+    Bsumtree block_tree; // Escape rate of every block
+    vector<double> element_array; // The elements (rates)
+    vector<unsigned long> block_length; // Slots in use per block (last nonzero slot + 1)
+    vector<char> dirty_array; // Is the block sum dirty?
+    vector<unsigned long> dirty_blocks;
+    vector<double> dirty_sums; // Scratch space for the bulk update of the block tree
+    unsigned long block_size;
+    unsigned long nrelements;
+};
+
+void Twoleveltree::initialize(unsigned long nrelements) { // Must be called before use
+    this->nrelements = nrelements;
+    unsigned long nrblocks = (nrelements + block_size - 1)/block_size;
+    element_array.assign(nrblocks*block_size, 0.0);
+    block_length.assign(nrblocks, 0);
+    dirty_array.assign(nrblocks, false);
+    dirty_blocks.clear();
+    block_tree.initialize(nrblocks);
+}
+
+void Twoleveltree::setrate(unsigned long i, double value) { // 0 <= i < nrelements
+    element_array[i] = value;
+    unsigned long block = i/block_size;
+    unsigned long slot = i - block*block_size;
+    unsigned long &length = block_length[block];
+    if (value > 0.0 && slot >= length) {
+        length = slot+1;
+    }
+    else if (value <= 0.0 && slot+1 == length) { // shrink to the last nonzero slot
+        while (length > 0 && element_array[block*block_size + length-1] <= 0.0) { length--; }
+    }
+    if (!dirty_array[block]) {
+        dirty_array[block] = true;
+        dirty_blocks.push_back(block);
+    }
+}
+
+double Twoleveltree::getrate(long i) {
+    return element_array[i];
+}
+
+double Twoleveltree::compute_sum() { // Returns total sum of all elements
+    // Block sums are recomputed from scratch (no round-off drift) and handed to the block tree in one update
+    if (!dirty_blocks.empty()) {
+        dirty_sums.resize(dirty_blocks.size());
+        for (unsigned long k = 0; k < dirty_blocks.size(); k++) {
+            dirty_sums[k] = Block_sum(dirty_blocks[k]);
+            dirty_array[dirty_blocks[k]] = false;
+        }
+        block_tree.setrates(&dirty_blocks[0], &dirty_sums[0], dirty_blocks.size());
+        dirty_blocks.clear();
+    }
+    return block_tree.compute_sum();
+}
+
+// Search returns index to element i: sum(0..i) <= searchkey < sum(0..i+1),
+// where the sum is taken over the succesive elements (same convention as Bsumtree).
+long Twoleveltree::search(double searchkey) { // Returns index to element
+    unsigned long block = block_tree.search_relative(searchkey);
+    const double* rates = &element_array[block*block_size];
+    unsigned long length = block_length[block];
+    if (length == 0) { return block*block_size; } // all rates are 0
+
+    // Running sum without an early exit, so there is no data dependent branch per slot
+    double partsum = 0.0;
+    unsigned long nrsmaller = 0;
+    for (unsigned long slot = 0; slot < length; slot++) {
+        partsum += rates[slot];
+        nrsmaller += (partsum < searchkey);
+    }
+    while (nrsmaller > 0 && (nrsmaller >= length || rates[nrsmaller] <= 0.0)) { // rounding or a zero slot, step back to a nonzero rate
+        nrsmaller--;
+    }
+    return block*block_size + nrsmaller;
+}
+
+void Twoleveltree::resize(unsigned long newsize) {
+    /*
+     *  When newsize >= oldsize: all elements are kept, new elements are 0.
+     *  When newsize < oldsize: excess elements are thrown away.
+     */
+    for (unsigned long i = newsize; i < nrelements; i++) {
+        setrate(i, 0.0);
+    }
+    compute_sum(); // no dirty block may refer past the new size
+    unsigned long nrblocks = (newsize + block_size - 1)/block_size;
+    element_array.resize(nrblocks*block_size, 0.0);
+    block_length.resize(nrblocks, 0);
+    dirty_array.resize(nrblocks, false);
+    block_tree.resize(nrblocks);
+    nrelements = newsize;
+}
+
+long Twoleveltree::getnrrates() {
+    return nrelements;
+}
+
+double Twoleveltree::Block_sum(unsigned long block) {
+    const double* rates = &element_array[block*block_size];
+    double sum = 0.0;
+    for (unsigned long slot = 0; slot < block_length[block]; slot++) { sum += rates[slot]; }
+    return sum;
+}
+
+}}
+
+#endif
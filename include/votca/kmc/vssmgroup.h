@@ -21,6 +21,8 @@
 
 #include <votca/kmc/events.h>
 #include <votca/kmc/globaleventinfo.h>
+#include <votca/kmc/groupselector.h>
+#include <votca/kmc/randombuffer.h>
 
 namespace votca { namespace kmc {
   
@@ -42,124 +44,95 @@ public:
     
 private:
 
-    double el_probsum;
-    double ho_probsum;
+    // Rate groups in the device: electron non-injection, electron injection, hole non-injection, hole injection, generation
+    // (the generation tree is NULL when generation is off, the group is then left out of the selection)
+    Groupselector<Ratetree,Ratetree,Ratetree,Ratetree,Ratetree> device_groups;
+    // Rate groups in the bulk: electron and hole non-injection, generation
+    Groupselector<Ratetree,Ratetree,Ratetree> bulk_groups;
+
+    Randombuffer<> randombuffer; // Block-wise uniforms and exponentials drawn from RandomVariable
+
     double tot_probsum;
     
-    double el_non_inject_probsum;
-    double ho_non_inject_probsum;
-    double el_inject_probsum;
-    double ho_inject_probsum;
-    
 };
 
 double Vssmgroup::Timestep(votca::tools::Random2 *RandomVariable){
 
-    double timestep;
-    
-    double rand_u = 1-RandomVariable->rand_uniform();
-    while(rand_u == 0) {
-        rand_u = 1-RandomVariable->rand_uniform();
-    }
-        
-    timestep = -1/tot_probsum*log(rand_u);
+    randombuffer.Set_RNG(RandomVariable);
+    double timestep = randombuffer.Exponential()/tot_probsum;
     return timestep;
     
 }
 
 void Vssmgroup::Recompute_in_device(Events* events){
     
+    device_groups.Set_trees(events->El_non_injection_rates, events->El_injection_rates, events->Ho_non_injection_rates, events->Ho_injection_rates,
+                            events->Generation_rates);
+
     if(events->el_dirty) {
-        el_non_inject_probsum = events->El_non_injection_rates->compute_sum();
-        el_inject_probsum = events->El_injection_rates->compute_sum();       
-        el_probsum = el_non_inject_probsum + el_inject_probsum;
+        device_groups.Recompute(0);
+        device_groups.Recompute(1);
         events->el_dirty = false;
     }
 
     if(events->ho_dirty) {
-        ho_non_inject_probsum = events->Ho_non_injection_rates->compute_sum();
-        ho_inject_probsum = events->Ho_injection_rates->compute_sum();       
-        ho_probsum = ho_non_inject_probsum + ho_inject_probsum;
+        device_groups.Recompute(2);
+        device_groups.Recompute(3);
         events->ho_dirty = false;
     }
 
-    tot_probsum = el_probsum + ho_probsum;
+    if(events->generation_dirty) {
+        device_groups.Recompute(4);
+        events->generation_dirty = false;
+    }
+
+    tot_probsum = device_groups.Total();
 }
 
 void Vssmgroup::Recompute_in_bulk(Events* events){
     
+    bulk_groups.Set_trees(events->El_non_injection_rates, events->Ho_non_injection_rates, events->Generation_rates);
+
     if(events->el_dirty) {
-        el_probsum = events->El_non_injection_rates->compute_sum();
+        bulk_groups.Recompute(0);
         events->el_dirty = false;
     }
 
     if(events->ho_dirty) {
-        ho_probsum = events->Ho_non_injection_rates->compute_sum();
+        bulk_groups.Recompute(1);
         events->ho_dirty = false;
     }
 
-    tot_probsum = el_probsum + ho_probsum;
+    if(events->generation_dirty) {
+        bulk_groups.Recompute(2);
+        events->generation_dirty = false;
+    }
+
+    tot_probsum = bulk_groups.Total();
     
 }
 
 void Vssmgroup::Perform_one_step_in_device(Events* events, Graph* graph, State* state, Globaleventinfo* globevent, votca::tools::Random2 *RandomVariable){
 
-    double randn = RandomVariable->rand_uniform();    
-    
+    Eventtable* group_events[] = {&events->El_non_injection_events, &events->El_injection_events,
+                                  &events->Ho_non_injection_events, &events->Ho_injection_events, &events->Generation_events};
+
     long event_ID;
-    Event* chosenevent;
-    
-    if(randn<el_probsum/tot_probsum) { // electron event
-        if(randn< el_non_inject_probsum/tot_probsum) { // non injection event
-            randn *= el_non_inject_probsum;
-            event_ID = events->El_non_injection_rates->search(randn);
-            chosenevent = events->El_non_injection_events[event_ID];
-        }
-        else { // injection event
-            randn -= el_non_inject_probsum/tot_probsum;
-            randn *= el_inject_probsum;
-            event_ID = events->El_injection_rates->search(randn);
-            chosenevent = events->El_injection_events[event_ID];
-        }
-    }
-    else { //Hole event
-        randn -= el_probsum/tot_probsum;
-        if(randn< ho_non_inject_probsum/tot_probsum) { // non injection event
-            randn *= ho_non_inject_probsum;
-            event_ID = events->Ho_non_injection_rates->search(randn);
-            chosenevent = events->Ho_non_injection_events[event_ID];
-        }
-        else { // injection event
-            randn -= ho_non_inject_probsum/tot_probsum;
-            randn *= ho_inject_probsum;
-            event_ID = events->Ho_injection_rates->search(randn);
-            chosenevent = events->Ho_injection_events[event_ID];
-        }
-    }
-    events->On_execute(chosenevent, graph, state, globevent);
+    randombuffer.Set_RNG(RandomVariable);
+    int group = device_groups.Select(randombuffer.Uniform(), event_ID);
+
+    events->On_execute(group_events[group], event_ID, graph, state, globevent);
 }
 
 void Vssmgroup::Perform_one_step_in_bulk(Events* events, Graph* graph, State* state, Globaleventinfo* globevent, votca::tools::Random2 *RandomVariable){
 
-    double randn = RandomVariable->rand_uniform();    
-    
-    //first search the particular bsumtree
-   
+    Eventtable* group_events[] = {&events->El_non_injection_events, &events->Ho_non_injection_events, &events->Generation_events};
+
     long event_ID;
-    Event* chosenevent;
-    
-    if(randn<el_probsum/tot_probsum) { // electron event
-        randn *= el_probsum;
-        event_ID = events->El_non_injection_rates->search(randn);
-        chosenevent = events->El_non_injection_events[event_ID];
-    }
-    else { //Hole event
-        randn -= el_probsum/tot_probsum;
-        randn *= ho_probsum;
-        event_ID = events->Ho_non_injection_rates->search(randn);
-        chosenevent = events->Ho_non_injection_events[event_ID];
-    }
-    events->On_execute(chosenevent, graph, state, globevent);
+    randombuffer.Set_RNG(RandomVariable);
+    int group = bulk_groups.Select(randombuffer.Uniform(), event_ID);
+
+    events->On_execute(group_events[group], event_ID, graph, state, globevent);
 }
 
 
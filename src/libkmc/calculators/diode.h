@@ -23,6 +23,8 @@
 #include <votca/kmc/globaleventinfo.h>
 #include <votca/kmc/events.h>
 #include <votca/kmc/vssmgroup.h>
+#include <votca/kmc/nextreactiongroup.h>
+#include <votca/kmc/philox.h>
 
 using namespace std;
 
@@ -39,6 +41,7 @@ public:
     State* state;
     Events* events;
     Vssmgroup* vssmgroup;
+    Nextreactiongroup* nextreactiongroup;
     Globaleventinfo* globevent;
     
     Diode() {};
@@ -54,6 +57,11 @@ public:
     int seed; long nr_equilsteps; long nr_timesteps; long steps_update_longrange;
     int nx; int ny; int nz; double lattice_constant; double hopdist; double disorder_strength; 
     double disorder_ratio; CorrelationType correlation_type; double left_electrode_distance; double right_electro_distance;
+    Ratetree_type ratetree_type;
+    double coulomb_table_memory; // MB
+    bool parallel_neighbours;
+    double generation_rate; // electron-hole pairs per unit time in the whole box
+    Inject_Type generation_weights;
 
 protected:
    void RunKMC(void); 
@@ -74,6 +82,49 @@ void Diode::Initialize(Property *options) {
     state = new State();
     events = new Events();
     vssmgroup = new Vssmgroup();
+    nextreactiongroup = new Nextreactiongroup();
+    
+    string key = "options.diode";
+    seed = 1;
+    if (options->exists(key+".seed")) {
+        seed = options->get(key+".seed").as<int>();
+    }
+    ratetree_type = Binary;
+    if (options->exists(key+".ratetree")) {
+        string ratetree = options->get(key+".ratetree").as<string>();
+        if (ratetree == "binary") {ratetree_type = Binary;}
+        else if (ratetree == "bnary") {ratetree_type = Bnary;}
+        else if (ratetree == "bnary_float") {ratetree_type = Bnary_float;}
+        else if (ratetree == "composition_rejection") {ratetree_type = Composition_rejection;}
+        else if (ratetree == "concurrent") {ratetree_type = Concurrent;}
+        else if (ratetree == "next_reaction") {ratetree_type = Next_reaction;}
+        else if (ratetree == "two_level") {ratetree_type = Two_level;}
+        else if (ratetree == "mesh_partitioned") {ratetree_type = Mesh_partitioned;}
+        else {
+            throw std::runtime_error(" Invalid ratetree option '" + ratetree + "'. ");
+        }
+    }
+    coulomb_table_memory = 1024.0;
+    if (options->exists(key+".coulomb_table_memory")) {
+        coulomb_table_memory = options->get(key+".coulomb_table_memory").as<double>();
+    }
+    parallel_neighbours = false;
+    if (options->exists(key+".parallel_neighbours")) {
+        parallel_neighbours = options->get(key+".parallel_neighbours").as<bool>();
+    }
+    generation_rate = 0.0;
+    if (options->exists(key+".generation_rate")) {
+        generation_rate = options->get(key+".generation_rate").as<double>();
+    }
+    generation_weights = Equal;
+    if (options->exists(key+".generation_weights")) {
+        string weights = options->get(key+".generation_weights").as<string>();
+        if (weights == "equal") {generation_weights = Equal;}
+        else if (weights == "fermi") {generation_weights = Fermi;}
+        else {
+            throw std::runtime_error(" Invalid generation_weights option '" + weights + "'. ");
+        }
+    }
 }
 
 bool Diode::EvaluateFrame() {
@@ -87,21 +138,34 @@ bool Diode::EvaluateFrame() {
 
 void Diode::RunKMC() {
  
-    //Setup random number generator
-    seed = 1;
-    srand(seed); // srand expects any integer in order to initialise the random number generator
+    //Setup random number generator, seeded from stream 0 of the counter-based generator (no global srand state)
+    Philox seeder(seed, 0);
     votca::tools::Random2 *RandomVariable = new votca::tools::Random2();
-    RandomVariable->init(rand(), rand(), rand(), rand());    
+    RandomVariable->init(seeder.rand_uint32() >> 1, seeder.rand_uint32() >> 1, seeder.rand_uint32() >> 1, seeder.rand_uint32() >> 1);    
     
     //Initialize all structures
+    globevent->formalism_type = Resolve_formalism(globevent->formalism);
     graph->hopdist = hopdist;
     graph->Generate_cubic_graph(nx, ny, nz, lattice_constant, disorder_strength,RandomVariable, disorder_ratio, 
                                 correlation_type, left_electrode_distance, right_electro_distance,globevent);   
     state->Init();    
+    state->Init_coulomb_mesh(graph, globevent);
+    globevent->generation_rate = generation_rate;
+    state->electron_inject = new Bsumtree();
+    state->hole_inject = new Bsumtree();
+    state->Initialize_inject_trees(graph, generation_weights, globevent);
+    events->nthreads = _nThreads;
+    events->Initialize_ratetrees(ratetree_type, RandomVariable, graph, globevent);
     events->Initialize_eventvector(graph, state, globevent);
     events->Initialize_longrange (graph, globevent);
-    events->Recompute_all_injection_events(graph, globevent);
-    events->Recompute_all_non_injection_events(graph, state, globevent); 
+    events->Initialize_coulomb_table(graph, globevent, _nThreads, coulomb_table_memory*1024.0*1024.0);
+    if(parallel_neighbours) {
+        events->Initialize_neighbour_team(graph, globevent, _nThreads);
+    }
+    events->Initialize_carriers(graph, state, globevent);
+    if(ratetree_type == Next_reaction) {
+        nextreactiongroup->Initialize_in_device(events);
+    }
     
     
     sim_time = 0.0;
@@ -114,9 +178,14 @@ void Diode::RunKMC() {
             events->Recompute_all_non_injection_events(graph,state,globevent);
         }
         
-        vssmgroup->Recompute_in_device(events);
-        sim_time += vssmgroup->Timestep(RandomVariable);
-        vssmgroup->Perform_one_step_in_device(events,graph,state,globevent,RandomVariable);
+        if(ratetree_type == Next_reaction) {
+            sim_time = nextreactiongroup->Perform_one_step(events,graph,state,globevent);
+        }
+        else {
+            vssmgroup->Recompute_in_device(events);
+            sim_time += vssmgroup->Timestep(RandomVariable);
+            vssmgroup->Perform_one_step_in_device(events,graph,state,globevent,RandomVariable);
+        }
     }
 }
 
@@ -15,6 +15,10 @@
 #include <votca/tools/mutex.h>
 #include <votca/tools/random2.h>
 
+#include <votca/kmc/aliastable.h>
+#include <votca/kmc/randombuffer.h>
+#include <votca/kmc/philox.h>
+
 
 namespace votca { namespace kmc {
     
@@ -29,7 +33,7 @@ public:
     using       KMCCalculator::Initialize;
     void        Initialize(const char *filename, Property *options );    
     bool        EvaluateFrame();
-    bool        RequestNextInjection(int opId);
+    bool        RequestNextInjection(int opId, int &run);
     
     
     // +++++++++++++++++++++ //
@@ -43,10 +47,10 @@ public:
     {
     public:
         
-        VSSMGroupBoxed() { _acc_rate.push_back(0); }
+        VSSMGroupBoxed() : _alias_built(false) { _acc_rate.push_back(0); }
        ~VSSMGroupBoxed() {};
 
-        void        SetRNG(Random2 *rng) { _random = rng; }
+        void        SetRNG(Randombuffer<Philox> *rng) { _random = rng; }
        
         void        AddEvent(event_t *event);
         double      Rate() { return _acc_rate.back(); };
@@ -60,11 +64,15 @@ public:
 
         event_t     *SelectEvent_LinearSearch();
         event_t     *SelectEvent_BinarySearch();
+        event_t     *SelectEvent_Alias();
+        void         BuildAliasTable();
 
         std::vector<event_t*>       _events;
         std::vector<double>         _acc_rate;
+        Aliastable                  _alias;
+        bool                        _alias_built;
         double                      _waiting_time;
-        Random2                    *_random;
+        Randombuffer<Philox>       *_random;
     };
     
     
@@ -132,20 +140,25 @@ public:
         void    InitSlotData();
         void    Run(void);
         
-        void    EvalKMC();
+        void    EvalKMC(int run);
         void    LoadGraph();
         void    RunKMC(void);
         void    WriteOcc(void);
         void    Reset();
         
-        void    Step(vec &dr, NodeBoxed *dest) { _pos += dr; _current = dest; }
+        void    Step(vec &dr, NodeBoxed *dest) { 
+            _pos += dr; 
+            _current = dest; 
+            _current->UpdateWaitingTime(); // drawn on arrival, so a run only consumes its own stream
+        }
         
     
     private:
         
         int                     _id;
         KMCParallel            *_master; 
-        Random2                 _random;
+        Philox                  _random; // reseeded with stream (seed, run) for every run
+        Randombuffer<Philox>    _randombuffer; // buffered variates of _random for the nodes
         
         map<int,NodeBoxed* >    _nodes_lookup;
         vector< NodeBoxed* >    _nodes;
@@ -169,12 +182,11 @@ private:
     int         _NRuns;
     int         _nextRun;
     int         _seed;
-    Random2     _seeder;
     
     // KMC log variables
     string      _outFile;
     bool        _kmc2File;
-    map<int, vector<vec> > _log_inj_vel;
+    map<int, pair<int, vec> > _log_run_vel; // run -> (injection, velocity)
     
     // Thread management
     Mutex       _injMutex;
@@ -217,11 +229,6 @@ void KMCParallel::Initialize(const char* filename, Property *options) {
     
     _outFile    = options->get(key+".output").as<string>();
     
-    // Init. master RNG
-    srand(_seed);
-    cout << endl << "... ... Master: " << flush;
-    _seeder.init(rand(), rand(), rand(), rand());
-    
 }
 
 
@@ -259,6 +266,13 @@ bool KMCParallel::EvaluateFrame() {
     FILE *out;
     out = fopen(_outFile.c_str(),"w");
     
+    // Group by injection in run order, independent of which thread did which run
+    map< int, vector<vec> > _log_inj_vel;
+    map< int, pair<int, vec> > ::iterator rit;
+    for (rit = _log_run_vel.begin(); rit != _log_run_vel.end(); ++rit) {
+        _log_inj_vel[(*rit).second.first].push_back((*rit).second.second);
+    }
+    
     map< int, vector<vec> > ::iterator mit;
     vector<vec> ::iterator vit;
     vec AVGVEL = vec(0,0,0);
@@ -287,7 +301,7 @@ bool KMCParallel::EvaluateFrame() {
 }
 
 
-bool KMCParallel::RequestNextInjection(int opId) {
+bool KMCParallel::RequestNextInjection(int opId, int &run) {
     
     _injMutex.Lock();
     
@@ -304,6 +318,7 @@ bool KMCParallel::RequestNextInjection(int opId) {
              << _nextRun << "/" << _NRuns
              << ". " << endl;
         
+        run = _nextRun;
         ++_nextRun;
         doNext = true;
     }
@@ -323,7 +338,7 @@ void KMCParallel::KMCSingleOp::InitSlotData() {
     
     // Initialise random-number generator
     cout << "... ... OP " << this->_id << ": " << flush;
-    this->_random.init(rand(), rand(), rand(), rand());
+    this->_randombuffer.Set_RNG(&this->_random);
     
     Database db;
     db.Open(_master->_stateFile);
@@ -343,7 +358,7 @@ void KMCParallel::KMCSingleOp::InitSlotData() {
         string  name    = stmt->Column<string>(1);
         
         NodeBoxed *newnode = new NodeBoxed(id);
-        newnode->SetRNG(&this->_random);
+        newnode->SetRNG(&this->_randombuffer);
         
         _nodes.push_back(newnode);
         _nodes_lookup[id] = _nodes.back();
@@ -414,16 +429,21 @@ void KMCParallel::KMCSingleOp::Run(void) {
     
     while (true) {
         
-        bool doNext = _master->RequestNextInjection(this->_id);
+        int run;
+        bool doNext = _master->RequestNextInjection(this->_id, run);
         
         if (!doNext) { break; }
-        else { this->EvalKMC(); }        
+        else { this->EvalKMC(run); }        
     }
 }
 
 
-void KMCParallel::KMCSingleOp::EvalKMC() {
+void KMCParallel::KMCSingleOp::EvalKMC(int run) {
 
+    // Every run has its own random stream, the same whatever thread executes it
+    _random.Init(_master->_seed, run);
+    _randombuffer.Reset();
+    
     // Pick injection site
     int inj = _random.rand_uniform_int(_injection.size());
     _current = _injection[inj];
@@ -476,7 +496,7 @@ void KMCParallel::KMCSingleOp::EvalKMC() {
     fclose(out);
     
     _master->_logMutex.Lock();
-    _master->_log_inj_vel[inj].push_back(_pos/t_run*1e-9);
+    _master->_log_run_vel[run] = pair<int, vec>(inj, _pos/t_run*1e-9);
     _master->_logMutex.Unlock();
     
     // Post-process
@@ -511,6 +531,7 @@ void KMCParallel::VSSMGroupBoxed<event_t>::AddEvent(event_t *event) {
     
     _events.push_back(event);
     _acc_rate.push_back(_acc_rate.back() + event->Rate());
+    _alias_built = false;
     
     UpdateWaitingTime();
 }
@@ -519,15 +540,14 @@ void KMCParallel::VSSMGroupBoxed<event_t>::AddEvent(event_t *event) {
 template<typename event_t>
 inline void KMCParallel::VSSMGroupBoxed<event_t>::UpdateWaitingTime() {
     
-    _waiting_time = -log( 1.0 - _random->rand_uniform() ) / Rate();
+    _waiting_time = _random->Exponential() / Rate();
 }
   
 
 template<typename event_t>
 inline void KMCParallel::VSSMGroupBoxed<event_t>::OnExecute() {
     
-    SelectEvent_BinarySearch()->OnExecute();
-    UpdateWaitingTime();
+    SelectEvent_Alias()->OnExecute(); // the destination draws its waiting time on arrival
 }
 
 
@@ -535,7 +555,7 @@ template<typename event_t>
 event_t *KMCParallel::VSSMGroupBoxed<event_t>::SelectEvent_BinarySearch() {
         
     //double max = Rate();
-    double u = 1.-_random->rand_uniform();
+    double u = 1.-_random->Uniform();
     u=u*Rate();	
 
     int imin = 0;
@@ -550,6 +570,27 @@ event_t *KMCParallel::VSSMGroupBoxed<event_t>::SelectEvent_BinarySearch() {
     return _events[imin];
 }
 
+
+template<typename event_t>
+inline event_t *KMCParallel::VSSMGroupBoxed<event_t>::SelectEvent_Alias() {
+    
+    // Rates are static after LoadGraph(), so the table is built once on first use
+    if (!_alias_built) { BuildAliasTable(); }
+    return _events[_alias.Draw(_random->Uniform())];
+}
+
+
+template<typename event_t>
+void KMCParallel::VSSMGroupBoxed<event_t>::BuildAliasTable() {
+    
+    std::vector<double> rates;
+    for (unsigned int i = 0; i < _events.size(); ++i) {
+        rates.push_back(_events[i]->Rate());
+    }
+    _alias.Initialize(rates);
+    _alias_built = true;
+}
+
 }}
 
 #endif